@@ -17,39 +17,170 @@
 
 #include <winsock2.h>
 #include <windows.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <stdint.h>
-#include <uthash.h>
 
 #include "addrcache.h"
+#include "addrtable.h"
 #include "common.h"
 #include "ipxwrapper.h"
 
-#define ADDR_CACHE_TTL 30
+/* Number of slots in the host table. Always a power of two, and twice the
+ * maximum number of entries so that probe sequences stay short.
+*/
+#define ADDR_CACHE_SLOTS (ADDR_CACHE_MAX_ENTRIES * 2)
+#define ADDR_CACHE_MASK  (ADDR_CACHE_SLOTS - 1)
 
-struct host_table_key {
-	addr32_t netnum;
-	addr48_t nodenum;
-	uint16_t socket;
-};
+/* Number of entries checked for expiry on each addr_cache_set() call. */
+#define ADDR_CACHE_SWEEP_STEP 4
+
+/* Name and number of slots of the table shared between processes. */
+#define ADDR_CACHE_SHARED_NAME  "ipxwrapper_addr_cache"
+#define ADDR_CACHE_SHARED_SLOTS (ADDR_CACHE_MAX_ENTRIES * 2)
+
+/* The host table is a flat array of 64 byte slots, one to a cache line, using
+ * open addressing with linear probing. Readers don't take any locks, writers
+ * are serialised by host_table_cs.
+ *
+ * Each slot holds the key and up to ADDR_CACHE_ENDPOINTS IPv4 address/port
+ * pairs, which is all that is ever cached. The node and socket numbers are
+ * packed into a single 64-bit word so that comparing a key is two integer
+ * comparisons. Every slot is protected by
+ * its sequence number, which is odd while a writer is updating it; readers
+ * copy each slot they probe and retry if the sequence number was odd or
+ * changed in the meantime.
+ *
+ * Deleting an entry moves any later entries in the same probe sequence back
+ * to fill the gap, so there are no tombstones and an unused slot always ends
+ * a probe. A reader looking for an entry while it is being moved may miss it,
+ * which is no worse than it having expired.
+ *
+ * A host with more than one interface is heard from at a different IP address
+ * through each of them, so each address is kept as a separate endpoint along
+ * with when it was last seen and which local interface it arrived on. Lookups
+ * prefer endpoints which haven't failed since they were last seen, then those
+ * which arrived on the interface the packet is being sent from, then the most
+ * recently seen. addr_cache_send_failed() counts a failure against an endpoint
+ * so that the next lookup moves on to another. Once every endpoint is in use,
+ * a new one replaces the least recently seen. Endpoints are kept with the most
+ * recently set first.
+ *
+ * Local interfaces are numbered in the order they are first seen, so an
+ * endpoint only needs a byte to record one.
+ *
+ * Used slots are also on an insertion ordered circular list, kept in the
+ * list_prev and list_next arrays and only accessed by writers. Once the table
+ * is full, entries are evicted using the CLOCK approximation of LRU: readers
+ * set the referenced flag of any entry they use, and clock_hand moves along
+ * the list giving referenced entries a second chance and evicting the first
+ * one which isn't. sweep_pos moves along the same list a few entries per
+ * addr_cache_set() call, removing any which have expired.
+ *
+ * Entries with a socket number of zero are host defaults, used for any socket
+ * on the host which doesn't have an entry of its own. Since every process on a
+ * host shares the same IPX address but has its own UDP port, a host default
+ * endpoint which is set to a different port while still fresh is marked
+ * ambiguous and not used until the TTL has passed since the last conflicting
+ * update.
+ *
+ * If addr_cache_init_shared() succeeds, the host table is left empty and the
+ * cache is kept in an addr_table_t in named shared memory instead, so every
+ * process on the host learns addresses from each other's routers.
+*/
+
+#define SLOT_USED     0x01
+#define SLOT_CONFLICT 0x02
+
+#define SLOT_NONE 0xFFFFFFFF
+
+/* Maximum number of local interfaces which can be told apart. Endpoints seen
+ * on any others are recorded with CACHE_IFACE_NONE.
+*/
+#define CACHE_IFACES_MAX 32
+#define CACHE_IFACE_NONE 0xFF
+
+/* addr48_t keeps the node number in the upper 48 bits of the word, leaving
+ * room for the socket number underneath it.
+*/
+#define HOST_KEY(node, sock) ((uint64_t)(node) | (uint16_t)(sock))
 
-struct host_table {
-	UT_hash_handle hh;
+struct host_endpoint {
+	uint32_t ipaddr;
+	volatile uint32_t time;
+	uint16_t port;
 	
-	struct host_table_key key;
-	time_t time;
+	/* Index of the local interface in cache_ifaces. */
+	uint8_t iface;
 	
-	SOCKADDR_STORAGE addr;
-	size_t addrlen;
+	/* Sends which failed since the endpoint was last seen. */
+	volatile uint8_t failures;
 };
 
-typedef struct host_table host_table_t;
-typedef struct host_table_key host_table_key_t;
+struct host_slot {
+	/* Node number in the upper 48 bits, socket number in the lower 16. */
+	uint64_t node_sock;
+	addr32_t netnum;
+	
+	volatile uint32_t seq;
+	
+	/* Time any endpoint was last seen. */
+	volatile uint32_t time;
+	
+	/* Time a host default was last set to a different port while still
+	 * fresh, only meaningful if SLOT_CONFLICT is set.
+	*/
+	uint32_t conflict_time;
+	
+	uint8_t flags;
+	volatile uint8_t referenced;
+	uint8_t n_endpoints;
+	
+	struct host_endpoint endpoints[ADDR_CACHE_ENDPOINTS];
+} __attribute__((aligned(64)));
+
+typedef struct host_slot host_slot_t;
 
-static host_table_t *host_table = NULL;
+static host_slot_t host_table[ADDR_CACHE_SLOTS] __attribute__((aligned(64)));
 static CRITICAL_SECTION host_table_cs;
 
+static uint32_t list_prev[ADDR_CACHE_SLOTS];
+static uint32_t list_next[ADDR_CACHE_SLOTS];
+
+static uint32_t list_head  = SLOT_NONE;
+static uint32_t clock_hand = SLOT_NONE;
+static uint32_t sweep_pos  = SLOT_NONE;
+
+/* Local interfaces, only ever appended to by writers. */
+static struct {
+	addr32_t net;
+	addr48_t node;
+} cache_ifaces[CACHE_IFACES_MAX];
+
+static volatile uint32_t n_cache_ifaces = 0;
+
+/* The lookup and send failure counters in stats are updated by readers without
+ * holding the lock, the rest are protected by host_table_cs.
+*/
+static struct addr_cache_stats stats;
+
+#define STAT_ADD(counter, n) __sync_fetch_and_add(&(counter), (uint64_t)(n))
+#define STAT_GET(counter)    __sync_fetch_and_add(&(counter), 0)
+
+static bool shared = false;
+static HANDLE shared_map = NULL;
+static void *shared_mem = NULL;
+static addr_table_t shared_table;
+
+/* Coarse clock used for entry timestamps, in seconds. Updated by
+ * addr_cache_tick() so that lookups don't need to call time().
+*/
+static volatile uint32_t cache_clock = 0;
+
+/* Seconds an entry remains valid after it was last set. */
+static volatile uint32_t cache_ttl = ADDR_CACHE_TTL;
+
 /* Lock the host table */
 static void host_table_lock(void)
 {
@@ -62,31 +193,284 @@ static void host_table_unlock(void)
 	LeaveCriticalSection(&host_table_cs);
 }
 
-/* Search the host table for a node with the given net/node pair.
- * Returns NULL on failure.
+/* Returns the first slot in the probe sequence of a key. The node number is
+ * in the upper bits of node_sock, so they are folded down before mixing.
+*/
+static uint32_t host_table_home(addr32_t net, uint64_t node_sock)
+{
+	uint64_t hash = ((uint64_t)(net) * 0x9E3779B97F4A7C15ULL) ^ node_sock;
+	
+	hash ^= hash >> 33;
+	hash *= 0xC2B2AE3D27D4EB4FULL;
+	hash ^= hash >> 29;
+	
+	return hash & ADDR_CACHE_MASK;
+}
+
+/* Take a consistent copy of a slot. */
+static void host_slot_copy(host_slot_t *dest, const host_slot_t *slot)
+{
+	uint32_t seq;
+	
+	do {
+		while((seq = slot->seq) & 1)
+		{
+			/* Slot is being updated. */
+			YieldProcessor();
+		}
+		
+		__sync_synchronize();
+		
+		memcpy(dest, (const void*)(slot), sizeof(*dest));
+		
+		__sync_synchronize();
+	} while(slot->seq != seq);
+}
+
+/* Overwrite everything but the sequence number of a slot. Must be called with
+ * the host table locked.
+*/
+static void host_slot_write(uint32_t i, const host_slot_t *src)
+{
+	host_slot_t *slot = &(host_table[i]);
+	
+	++(slot->seq);
+	__sync_synchronize();
+	
+	slot->node_sock     = src->node_sock;
+	slot->netnum        = src->netnum;
+	slot->time          = src->time;
+	slot->conflict_time = src->conflict_time;
+	slot->flags         = src->flags;
+	slot->referenced    = src->referenced;
+	slot->n_endpoints   = src->n_endpoints;
+	
+	memcpy(slot->endpoints, src->endpoints, sizeof(slot->endpoints));
+	
+	__sync_synchronize();
+	++(slot->seq);
+}
+
+/* Search the host table for a key, copying its slot to *copy. Returns the
+ * index of the slot, or SLOT_NONE if the key isn't in the table.
+*/
+static uint32_t host_table_find(host_slot_t *copy, addr32_t net, uint64_t node_sock)
+{
+	uint32_t i = host_table_home(net, node_sock);
+	
+	for(uint32_t n = 0; n < ADDR_CACHE_SLOTS; ++n, i = (i + 1) & ADDR_CACHE_MASK)
+	{
+		host_slot_copy(copy, &(host_table[i]));
+		
+		if(!(copy->flags & SLOT_USED))
+		{
+			break;
+		}
+		
+		if(copy->node_sock == node_sock && copy->netnum == net)
+		{
+			return i;
+		}
+	}
+	
+	return SLOT_NONE;
+}
+
+/* Returns the index of a local interface, or CACHE_IFACE_NONE if it hasn't
+ * been seen yet.
+*/
+static uint8_t cache_iface_find(addr32_t net, addr48_t node)
+{
+	uint32_t n = n_cache_ifaces;
+	
+	__sync_synchronize();
+	
+	for(uint32_t i = 0; i < n; ++i)
+	{
+		if(cache_ifaces[i].net == net && cache_ifaces[i].node == node)
+		{
+			return i;
+		}
+	}
+	
+	return CACHE_IFACE_NONE;
+}
+
+/* Returns the index of a local interface, numbering it if it hasn't been seen
+ * yet. Must be called with the host table locked.
 */
-static host_table_t *host_table_find(addr32_t net, addr48_t node, uint16_t sock)
+static uint8_t cache_iface_add(addr32_t net, addr48_t node)
 {
-	host_table_key_t key;
-	memset(&key, 0, sizeof(key));
+	uint8_t i = cache_iface_find(net, node);
+	
+	if(i == CACHE_IFACE_NONE && n_cache_ifaces < CACHE_IFACES_MAX)
+	{
+		i = n_cache_ifaces;
+		
+		cache_ifaces[i].net  = net;
+		cache_ifaces[i].node = node;
+		
+		__sync_synchronize();
+		
+		++n_cache_ifaces;
+	}
 	
-	key.netnum  = net;
-	key.nodenum = node;
-	key.socket  = sock;
+	return i;
+}
+
+/* Add a slot to the end of the list. */
+static void host_list_append(uint32_t i)
+{
+	if(list_head == SLOT_NONE)
+	{
+		list_head = list_prev[i] = list_next[i] = i;
+	}
+	else{
+		uint32_t tail = list_prev[list_head];
+		
+		list_prev[i] = tail;
+		list_next[i] = list_head;
+		
+		list_next[tail]      = i;
+		list_prev[list_head] = i;
+	}
+}
 
-	host_table_t *host;
+/* Remove a slot from the list, moving anything which refers to it on to the
+ * next slot.
+*/
+static void host_list_unlink(uint32_t i)
+{
+	uint32_t next = (list_next[i] != i) ? list_next[i] : SLOT_NONE;
+	
+	if(next != SLOT_NONE)
+	{
+		list_next[list_prev[i]] = list_next[i];
+		list_prev[list_next[i]] = list_prev[i];
+	}
+	
+	if(list_head == i)
+	{
+		list_head = next;
+	}
 	
-	HASH_FIND(hh, host_table, &key, sizeof(key), host);
+	if(clock_hand == i)
+	{
+		clock_hand = next;
+	}
 	
-	return host;
+	if(sweep_pos == i)
+	{
+		sweep_pos = next;
+	}
 }
 
-/* Delete a node from the host table */
-static void host_table_delete(host_table_t *host)
+/* Update the list after the entry in one slot has been moved to another. */
+static void host_list_move(uint32_t from, uint32_t to)
 {
-	HASH_DEL(host_table, host);
+	if(list_next[from] == from)
+	{
+		list_prev[to] = list_next[to] = to;
+	}
+	else{
+		list_prev[to] = list_prev[from];
+		list_next[to] = list_next[from];
+		
+		list_next[list_prev[to]] = to;
+		list_prev[list_next[to]] = to;
+	}
+	
+	if(list_head == from)
+	{
+		list_head = to;
+	}
+	
+	if(clock_hand == from)
+	{
+		clock_hand = to;
+	}
 	
-	free(host);
+	if(sweep_pos == from)
+	{
+		sweep_pos = to;
+	}
+}
+
+/* Delete the entry in a slot, moving any later entries in the same probe
+ * sequence back to fill the gap. Must be called with the host table locked.
+*/
+static void host_table_delete(uint32_t i)
+{
+	host_list_unlink(i);
+	--(stats.entries);
+	
+	uint32_t hole = i;
+	
+	for(uint32_t j = (i + 1) & ADDR_CACHE_MASK; host_table[j].flags & SLOT_USED; j = (j + 1) & ADDR_CACHE_MASK)
+	{
+		/* An entry can be moved back into the hole unless its home slot
+		 * lies between the hole and where it is now.
+		*/
+		
+		uint32_t home = host_table_home(host_table[j].netnum, host_table[j].node_sock);
+		
+		if(((j - home) & ADDR_CACHE_MASK) >= ((j - hole) & ADDR_CACHE_MASK))
+		{
+			host_slot_write(hole, &(host_table[j]));
+			host_list_move(j, hole);
+			
+			hole = j;
+		}
+	}
+	
+	host_slot_t empty;
+	memset(&empty, 0, sizeof(empty));
+	
+	host_slot_write(hole, &empty);
+}
+
+/* Evict one entry using the CLOCK algorithm. */
+static void host_table_evict(void)
+{
+	if(clock_hand == SLOT_NONE)
+	{
+		clock_hand = list_head;
+	}
+	
+	/* Readers may be setting the referenced flags again behind the hand,
+	 * so give up looking after one full turn.
+	*/
+	
+	for(uint64_t i = 0; host_table[clock_hand].referenced && i < stats.entries; ++i)
+	{
+		host_table[clock_hand].referenced = 0;
+		clock_hand = list_next[clock_hand];
+	}
+	
+	host_table_delete(clock_hand);
+	
+	++(stats.evictions);
+}
+
+/* Check the next few entries on the list and delete any which have expired. */
+static void host_table_sweep(void)
+{
+	for(int i = 0; i < ADDR_CACHE_SWEEP_STEP && list_head != SLOT_NONE; ++i)
+	{
+		if(sweep_pos == SLOT_NONE)
+		{
+			sweep_pos = list_head;
+		}
+		
+		uint32_t slot = sweep_pos;
+		sweep_pos = list_next[slot];
+		
+		if((cache_clock - host_table[slot].time) >= cache_ttl)
+		{
+			host_table_delete(slot);
+			++(stats.expired);
+		}
+	}
 }
 
 /* Initialise the address cache */
@@ -97,18 +481,34 @@ void addr_cache_init(void)
 		log_printf(LOG_ERROR, "Failed to initialise critical section: %s", w32_error(GetLastError()));
 		abort();
 	}
+	
+	memset(host_table, 0, sizeof(host_table));
+	
+	list_head  = SLOT_NONE;
+	clock_hand = SLOT_NONE;
+	sweep_pos  = SLOT_NONE;
+	
+	n_cache_ifaces = 0;
+	
+	memset(&stats, 0, sizeof(stats));
+	
+	cache_ttl = ADDR_CACHE_TTL;
+	
+	addr_cache_tick();
 }
 
-/* Free all resources used by the address cache */
+/* Free all resources used by the address cache. */
 void addr_cache_cleanup(void)
 {
-	/* Delete all nodes in the host table */
-	
-	host_table_t *host, *tmp;
-	
-	HASH_ITER(hh, host_table, host, tmp)
+	if(shared)
 	{
-		host_table_delete(host);
+		UnmapViewOfFile(shared_mem);
+		shared_mem = NULL;
+		
+		CloseHandle(shared_map);
+		shared_map = NULL;
+		
+		shared = false;
 	}
 	
 	/* Delete the host table lock */
@@ -116,72 +516,821 @@ void addr_cache_cleanup(void)
 	DeleteCriticalSection(&host_table_cs);
 }
 
-/* Search the address cache for the best address to send a packet to.
- *
- * Writes a sockaddr structure and addrlen to the provided pointers. Returns
- * true if a cached address was found, false otherwise.
+/* Switch the address cache over to the table shared by every process on the
+ * host, creating it if this is the first. Must be called after
+ * addr_cache_init() and before the cache is used. Returns false and keeps
+ * using the private cache on failure.
 */
-int addr_cache_get(SOCKADDR_STORAGE *addr, size_t *addrlen, addr32_t net, addr48_t node, uint16_t sock)
+bool addr_cache_init_shared(void)
+{
+	size_t size = addr_table_size(ADDR_CACHE_SHARED_SLOTS);
+	
+	if(!(shared_map = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, size, ADDR_CACHE_SHARED_NAME)))
+	{
+		log_printf(LOG_ERROR, "Error creating file mapping %s: %s", ADDR_CACHE_SHARED_NAME, w32_error(GetLastError()));
+		return false;
+	}
+	
+	if(!(shared_mem = MapViewOfFile(shared_map, FILE_MAP_ALL_ACCESS, 0, 0, size)))
+	{
+		log_printf(LOG_ERROR, "Error mapping %s: %s", ADDR_CACHE_SHARED_NAME, w32_error(GetLastError()));
+		
+		CloseHandle(shared_map);
+		shared_map = NULL;
+		
+		return false;
+	}
+	
+	if(!addr_table_attach(&shared_table, shared_mem, size))
+	{
+		log_printf(LOG_ERROR, "Shared address cache is in use by an incompatible version of IPXWrapper");
+		
+		UnmapViewOfFile(shared_mem);
+		shared_mem = NULL;
+		
+		CloseHandle(shared_map);
+		shared_map = NULL;
+		
+		return false;
+	}
+	
+	shared = true;
+	
+	log_printf(LOG_INFO, "Using shared address cache");
+	
+	return true;
+}
+
+/* Change how long entries remain valid, in seconds. */
+void addr_cache_set_ttl(uint32_t ttl)
+{
+	cache_ttl = ttl;
+}
+
+/* Refresh the coarse clock used by the address cache. Called by the router
+ * thread each time it wakes up, at least once a second.
+*/
+void addr_cache_tick(void)
+{
+	cache_clock = time(NULL);
+}
+
+/* Insert or update an endpoint in the host table, as if it was seen at the
+ * given time.
+*/
+static void host_table_set(addr32_t net, uint64_t node_sock, uint32_t ipaddr, uint16_t port, addr32_t iface_net, addr48_t iface_node, uint32_t now)
 {
 	host_table_lock();
 	
-	host_table_t *host = host_table_find(net, node, sock);
+	host_table_sweep();
+	
+	uint8_t iface = cache_iface_add(iface_net, iface_node);
+	
+	host_slot_t slot;
+	uint32_t i = host_table_find(&slot, net, node_sock);
 	
-	if(host && time(NULL) < host->time + ADDR_CACHE_TTL)
+	if(i == SLOT_NONE)
 	{
-		memcpy(addr, &(host->addr), host->addrlen);
-		*addrlen = host->addrlen;
+		/* The key doesn't exist in the address cache. Make room if
+		 * the cache is full, then fill in the first unused slot in
+		 * its probe sequence.
+		*/
+		
+		if(stats.entries >= ADDR_CACHE_MAX_ENTRIES)
+		{
+			host_table_evict();
+		}
+		
+		memset(&slot, 0, sizeof(slot));
+		
+		slot.node_sock   = node_sock;
+		slot.netnum      = net;
+		slot.flags       = SLOT_USED;
+		slot.time        = now;
+		slot.n_endpoints = 1;
+		
+		slot.endpoints[0].ipaddr = ipaddr;
+		slot.endpoints[0].port   = port;
+		slot.endpoints[0].iface  = iface;
+		slot.endpoints[0].time   = now;
+		
+		for(i = host_table_home(net, node_sock); host_table[i].flags & SLOT_USED; i = (i + 1) & ADDR_CACHE_MASK) {}
+		
+		host_slot_write(i, &slot);
+		
+		host_list_append(i);
+		
+		++(stats.entries);
+		++(stats.inserts);
 		
 		host_table_unlock();
-		return 1;
+		return;
 	}
 	
+	/* Find the endpoint with the same IP address, if there is one. */
+	
+	unsigned int e;
+	for(e = 0; e < slot.n_endpoints && slot.endpoints[e].ipaddr != ipaddr; ++e) {}
+	
+	struct host_endpoint *ep = &(slot.endpoints[e]);
+	
+	if(e < slot.n_endpoints && ep->port == port && ep->iface == iface && ep->failures == 0)
+	{
+		/* Endpoint hasn't changed, just refresh the timestamps. A
+		 * single aligned word is written atomically, so the slot
+		 * doesn't need to be marked as being updated.
+		*/
+		
+		if((int32_t)(now - ep->time) > 0)
+		{
+			host_table[i].endpoints[e].time = now;
+		}
+		
+		if((int32_t)(now - slot.time) > 0)
+		{
+			host_table[i].time = now;
+		}
+		
+		++(stats.updates);
+		
+		host_table_unlock();
+		return;
+	}
+	
+	if(e < slot.n_endpoints)
+	{
+		/* A host default which moves to a different port while still
+		 * fresh is being set by more than one process on the same
+		 * host. One which had already gone stale has just moved, so
+		 * check the old time before refreshing it.
+		*/
+		
+		if((node_sock & 0xFFFF) == 0 && ep->port != port && (cache_clock - ep->time) < cache_ttl)
+		{
+			slot.flags        |= SLOT_CONFLICT;
+			slot.conflict_time = cache_clock;
+		}
+		
+		if((int32_t)(now - ep->time) > 0)
+		{
+			ep->time = now;
+		}
+	}
+	else if(slot.n_endpoints < ADDR_CACHE_ENDPOINTS)
+	{
+		ep = &(slot.endpoints[slot.n_endpoints++]);
+		ep->time = now;
+	}
+	else{
+		/* Replace the least recently seen endpoint. */
+		
+		ep = &(slot.endpoints[0]);
+		
+		for(e = 1; e < slot.n_endpoints; ++e)
+		{
+			if((int32_t)(ep->time - slot.endpoints[e].time) >= 0)
+			{
+				ep = &(slot.endpoints[e]);
+			}
+		}
+		
+		ep->time = now;
+	}
+	
+	ep->ipaddr   = ipaddr;
+	ep->port     = port;
+	ep->iface    = iface;
+	ep->failures = 0;
+	
+	/* Keep the most recently set endpoint first, so it wins any tie. */
+	
+	struct host_endpoint latest = *ep;
+	
+	memmove(&(slot.endpoints[1]), &(slot.endpoints[0]), (ep - slot.endpoints) * sizeof(*ep));
+	slot.endpoints[0] = latest;
+	
+	if((int32_t)(now - slot.time) > 0)
+	{
+		slot.time = now;
+	}
+	
+	host_slot_write(i, &slot);
+	
+	++(stats.updates);
 	
 	host_table_unlock();
-	return 0;
 }
 
-/* Update the address cache.
+/* Returns true if endpoint a is a better choice than endpoint b for sending
+ * from the given interface.
+*/
+static bool host_endpoint_better(const struct host_endpoint *a, const struct host_endpoint *b, uint8_t iface)
+{
+	if(a->failures != b->failures)
+	{
+		return a->failures < b->failures;
+	}
+	
+	bool a_local = (iface != CACHE_IFACE_NONE && a->iface == iface);
+	bool b_local = (iface != CACHE_IFACE_NONE && b->iface == iface);
+	
+	if(a_local != b_local)
+	{
+		return a_local;
+	}
+	
+	return (int32_t)(a->time - b->time) > 0;
+}
+
+/* Copy the best address of a key from the host table, returns false if it
+ * isn't there, has expired or is an ambiguous host default. Sets *expired if
+ * the key was only found with expired addresses.
+*/
+static bool host_table_read(SOCKADDR_STORAGE *addr, size_t *addrlen, bool *expired, addr32_t net, addr48_t node, uint16_t sock, uint8_t iface)
+{
+	host_slot_t copy;
+	uint32_t i = host_table_find(&copy, net, HOST_KEY(node, sock));
+	
+	if(i == SLOT_NONE)
+	{
+		return false;
+	}
+	
+	const struct host_endpoint *best = NULL;
+	
+	for(unsigned int e = 0; e < copy.n_endpoints; ++e)
+	{
+		const struct host_endpoint *ep = &(copy.endpoints[e]);
+		
+		if((cache_clock - ep->time) < cache_ttl
+			&& (best == NULL || host_endpoint_better(ep, best, iface)))
+		{
+			best = ep;
+		}
+	}
+	
+	if(best == NULL)
+	{
+		*expired = true;
+		return false;
+	}
+	
+	if((copy.flags & SLOT_CONFLICT) && (cache_clock - copy.conflict_time) < cache_ttl)
+	{
+		return false;
+	}
+	
+	if(!host_table[i].referenced)
+	{
+		host_table[i].referenced = 1;
+	}
+	
+	struct sockaddr_in *sin = (struct sockaddr_in*)(addr);
+	memset(sin, 0, sizeof(*sin));
+	
+	sin->sin_family      = AF_INET;
+	sin->sin_addr.s_addr = best->ipaddr;
+	sin->sin_port        = best->port;
+	
+	*addrlen = sizeof(*sin);
+	
+	return true;
+}
+
+/* Copy an address from the shared table, returns false if it isn't there, has
+ * expired or is an ambiguous host default. Sets *expired if the key was only
+ * found with an expired address.
+*/
+static bool shared_table_read(SOCKADDR_STORAGE *addr, size_t *addrlen, bool *expired, addr32_t net, addr48_t node, uint16_t sock)
+{
+	struct addr_table_value value;
+	
+	if(!addr_table_get(&shared_table, net, node, sock, &value))
+	{
+		return false;
+	}
+	
+	/* Other processes may be up to a tick ahead of our clock. */
+	
+	int32_t ttl = cache_ttl;
+	
+	if((int32_t)(cache_clock - value.time) >= ttl)
+	{
+		*expired = true;
+		return false;
+	}
+	
+	if(sock == 0 && value.conflict && (int32_t)(cache_clock - value.conflict_time) < ttl)
+	{
+		return false;
+	}
+	
+	memcpy(addr, value.addr, value.addrlen);
+	*addrlen = value.addrlen;
+	
+	return true;
+}
+
+/* Search the address cache for the best address to send a packet to from the
+ * given local interface.
+ *
+ * Writes a sockaddr structure and addrlen to the provided pointers. Returns
+ * true if a cached address was found, false otherwise. If there is no address
+ * for the socket, the host's default address is used if known.
+ * 
+ * The shared cache only holds one address for each key, so the interface is
+ * only used to pick between endpoints in the private cache.
+ * 
+ * Never blocks, even while the cache is being updated.
+*/
+int addr_cache_get(SOCKADDR_STORAGE *addr, size_t *addrlen, addr32_t net, addr48_t node, uint16_t sock, addr32_t iface_net, addr48_t iface_node)
+{
+	bool expired = false;
+	bool found;
+	
+	if(shared)
+	{
+		found = shared_table_read(addr, addrlen, &expired, net, node, sock)
+			|| (sock != 0 && shared_table_read(addr, addrlen, &expired, net, node, 0));
+	}
+	else{
+		uint8_t iface = cache_iface_find(iface_net, iface_node);
+		
+		found = host_table_read(addr, addrlen, &expired, net, node, sock, iface)
+			|| (sock != 0 && host_table_read(addr, addrlen, &expired, net, node, 0, iface));
+	}
+	
+	if(found)
+	{
+		STAT_ADD(stats.hits, 1);
+	}
+	else{
+		STAT_ADD(stats.misses, 1);
+		
+		if(expired)
+		{
+			STAT_ADD(stats.expired_misses, 1);
+		}
+	}
+	
+	return found;
+}
+
+/* Update the address cache with an address seen on the given local interface.
  *
  * The given address will be treated as the host's defaut (i.e router port) if
- * sock is zero, otherwise it will be for the given socket number only.
+ * sock is zero, otherwise it will be for the given socket number only. Only
+ * IPv4 addresses can be cached. An address at a different IP to those already
+ * known for the key is added as another endpoint.
  *
  * The given sockaddr structure will be copied and may be deallocated as soon as
  * this function returns.
 */
-void addr_cache_set(const struct sockaddr *addr, size_t addrlen, addr32_t net, addr48_t node, uint16_t sock)
+void addr_cache_set(const struct sockaddr *addr, size_t addrlen, addr32_t net, addr48_t node, uint16_t sock, addr32_t iface_net, addr48_t iface_node)
+{
+	if(addrlen < sizeof(struct sockaddr_in) || addr->sa_family != AF_INET)
+	{
+		log_printf(LOG_ERROR, "Tried caching a non-IPv4 address!");
+		return;
+	}
+	
+	const struct sockaddr_in *sin = (const struct sockaddr_in*)(addr);
+	
+	if(shared)
+	{
+		if(!addr_table_set(&shared_table, net, node, sock, sin, sizeof(*sin), cache_clock, cache_ttl))
+		{
+			log_printf(LOG_DEBUG, "Shared address cache is busy, address not cached");
+		}
+		
+		return;
+	}
+	
+	host_table_set(net, HOST_KEY(node, sock), sin->sin_addr.s_addr, sin->sin_port, iface_net, iface_node, cache_clock);
+}
+
+/* Count a failure against the endpoint with a given address, in the entry for
+ * the socket and the host default. The next addr_cache_get() for either will
+ * prefer any other endpoint which hasn't failed, until the address is seen
+ * again.
+ *
+ * Never blocks. A failure may be lost if the entry is being updated at the
+ * same time, which just means another one will be needed to move on.
+*/
+void addr_cache_send_failed(const struct sockaddr *addr, size_t addrlen, addr32_t net, addr48_t node, uint16_t sock)
+{
+	if(addrlen < sizeof(struct sockaddr_in) || addr->sa_family != AF_INET)
+	{
+		return;
+	}
+	
+	STAT_ADD(stats.send_failures, 1);
+	
+	if(shared)
+	{
+		return;
+	}
+	
+	const struct sockaddr_in *sin = (const struct sockaddr_in*)(addr);
+	
+	for(int n = 0; n < 2; ++n)
+	{
+		host_slot_t copy;
+		uint32_t i = host_table_find(&copy, net, HOST_KEY(node, (n == 0 ? sock : 0)));
+		
+		if(i == SLOT_NONE)
+		{
+			continue;
+		}
+		
+		for(unsigned int e = 0; e < copy.n_endpoints; ++e)
+		{
+			if(copy.endpoints[e].ipaddr == sin->sin_addr.s_addr
+				&& copy.endpoints[e].port == sin->sin_port
+				&& host_table[i].endpoints[e].failures < 0xFF)
+			{
+				__sync_fetch_and_add(&(host_table[i].endpoints[e].failures), 1);
+			}
+		}
+		
+		if(sock == 0)
+		{
+			break;
+		}
+	}
+}
+
+/* Copy the address cache statistics. */
+void addr_cache_get_stats(struct addr_cache_stats *dest)
 {
 	host_table_lock();
+	*dest = stats;
+	host_table_unlock();
+	
+	dest->hits           = STAT_GET(stats.hits);
+	dest->misses         = STAT_GET(stats.misses);
+	dest->expired_misses = STAT_GET(stats.expired_misses);
+	dest->send_failures  = STAT_GET(stats.send_failures);
+}
+
+struct dump_state {
+	struct addr_cache_entry *entries;
+	uint32_t max_entries;
 	
-	host_table_t *host = host_table_find(net, node, sock);
+	/* Number of entries found, including those which didn't fit. */
+	uint32_t n_entries;
 	
-	if(!host)
+	bool usable_only;
+};
+
+/* Add an entry to a dump, if there is room. Expired and ambiguous entries are
+ * flagged as such, or skipped if usable_only is set.
+*/
+static void dump_entry(struct dump_state *state, addr32_t net, addr48_t node, uint16_t sock, uint32_t ipaddr, uint16_t port, uint32_t age, bool conflict, addr32_t iface_net, addr48_t iface_node)
+{
+	uint16_t flags = 0;
+	
+	if(age >= cache_ttl)
 	{
-		/* The net/node pair doesn't exist in the address cache.
-		 * Initialise an entry with no data and insert it.
-		*/
+		flags |= ADDR_CACHE_ENTRY_EXPIRED;
+	}
+	
+	if(conflict)
+	{
+		flags |= ADDR_CACHE_ENTRY_CONFLICT;
+	}
+	
+	if(flags && state->usable_only)
+	{
+		return;
+	}
+	
+	if(state->n_entries < state->max_entries)
+	{
+		struct addr_cache_entry *entry = &(state->entries[state->n_entries]);
+		memset(entry, 0, sizeof(*entry));
+		
+		addr32_out(entry->net, net);
+		addr48_out(entry->node, node);
+		memcpy(entry->socket, &sock, sizeof(sock));
+		
+		entry->ipaddr = ipaddr;
+		entry->port   = port;
+		entry->flags  = flags;
+		entry->age    = age;
+		
+		addr32_out(entry->iface_net, iface_net);
+		addr48_out(entry->iface_node, iface_node);
+	}
+	
+	++(state->n_entries);
+}
+
+/* Write a snapshot of the address cache to buf, with as many entries as fit.
+ * Returns the size needed to hold every entry.
+*/
+static size_t cache_dump(void *buf, size_t size, bool usable_only)
+{
+	struct addr_cache_file_header *header = buf;
+	
+	struct dump_state state = {
+		.entries     = header ? (struct addr_cache_entry*)(header + 1) : NULL,
+		.max_entries = (size >= sizeof(*header)) ? (size - sizeof(*header)) / sizeof(struct addr_cache_entry) : 0,
+		.n_entries   = 0,
+		.usable_only = usable_only,
+	};
+	
+	if(shared)
+	{
+		int32_t ttl = cache_ttl;
+		
+		for(uint32_t i = 0; i < shared_table.n_slots; ++i)
+		{
+			addr32_t net;
+			addr48_t node;
+			uint16_t sock;
+			struct addr_table_value value;
+			
+			if(!addr_table_get_slot(&shared_table, i, &net, &node, &sock, &value)
+				|| value.addrlen != sizeof(struct sockaddr_in))
+			{
+				continue;
+			}
+			
+			const struct sockaddr_in *sin = (const struct sockaddr_in*)(value.addr);
+			
+			int32_t age = cache_clock - value.time;
+			
+			dump_entry(&state, net, node, sock, sin->sin_addr.s_addr, sin->sin_port, (age > 0 ? age : 0),
+				(sock == 0 && value.conflict && (int32_t)(cache_clock - value.conflict_time) < ttl),
+				0, 0);
+		}
+	}
+	else{
+		host_table_lock();
+		
+		uint32_t i = list_head;
+		
+		for(uint64_t n = 0; n < stats.entries; ++n, i = list_next[i])
+		{
+			const host_slot_t *slot = &(host_table[i]);
+			
+			bool conflict = (slot->flags & SLOT_CONFLICT) && (cache_clock - slot->conflict_time) < cache_ttl;
+			
+			for(unsigned int e = 0; e < slot->n_endpoints; ++e)
+			{
+				const struct host_endpoint *ep = &(slot->endpoints[e]);
+				
+				addr32_t iface_net  = 0;
+				addr48_t iface_node = 0;
+				
+				if(ep->iface != CACHE_IFACE_NONE)
+				{
+					iface_net  = cache_ifaces[ep->iface].net;
+					iface_node = cache_ifaces[ep->iface].node;
+				}
+				
+				dump_entry(&state, slot->netnum, slot->node_sock & ~(uint64_t)(0xFFFF), slot->node_sock & 0xFFFF,
+					ep->ipaddr, ep->port, cache_clock - ep->time, conflict, iface_net, iface_node);
+			}
+		}
 		
-		if(!(host = malloc(sizeof(host_table_t))))
+		host_table_unlock();
+	}
+	
+	if(size >= sizeof(*header))
+	{
+		header->magic      = ADDR_CACHE_FILE_MAGIC;
+		header->version    = ADDR_CACHE_FILE_VERSION;
+		header->entry_size = sizeof(struct addr_cache_entry);
+		header->saved_at   = cache_clock;
+		header->n_entries  = (state.n_entries < state.max_entries) ? state.n_entries : state.max_entries;
+	}
+	
+	return sizeof(*header) + ((size_t)(state.n_entries) * sizeof(struct addr_cache_entry));
+}
+
+/* Write a snapshot of every entry in the address cache to buf, including any
+ * which are expired or ambiguous. Entries which don't fit are left out.
+ * Returns the size needed to hold every entry.
+*/
+size_t addr_cache_dump(void *buf, size_t size)
+{
+	return cache_dump(buf, size, false);
+}
+
+/* Write every fresh, unambiguous entry in the address cache to a snapshot file
+ * for addr_cache_load() to restore in a later process. The file is replaced
+ * atomically so a reader never sees a partial snapshot.
+ *
+ * Only the private cache is saved, the shared one outlives each process by
+ * itself. Returns false if nothing was written.
+*/
+bool addr_cache_save(const char *path)
+{
+	if(shared)
+	{
+		return false;
+	}
+	
+	/* Entries may be added while the snapshot is being taken, so grow the
+	 * buffer until everything fits.
+	*/
+	
+	size_t size = cache_dump(NULL, 0, true);
+	struct addr_cache_file_header *header = NULL;
+	
+	while(1)
+	{
+		void *new_header = realloc(header, size);
+		if(!new_header)
 		{
-			log_printf(LOG_ERROR, "Cannot allocate memory for host_table_t!");
+			log_printf(LOG_ERROR, "Cannot allocate memory for address cache snapshot");
 			
-			host_table_unlock();
-			return;
+			free(header);
+			return false;
 		}
 		
-		memset(host, 0, sizeof(host_table_t));
+		header = new_header;
 		
-		host->key.netnum  = net;
-		host->key.nodenum = node;
-		host->key.socket  = sock;
+		size_t needed = cache_dump(header, size, true);
 		
-		HASH_ADD(hh, host_table, key, sizeof(host->key), host);
+		if(needed <= size)
+		{
+			size = needed;
+			break;
+		}
+		
+		size = needed;
 	}
 	
-	memcpy(&(host->addr), addr, addrlen);
-	host->addrlen = addrlen;
+	uint32_t n_entries = header->n_entries;
 	
-	host->time = time(NULL);
+	char tmp_path[MAX_PATH];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
 	
-	host_table_unlock();
+	HANDLE file = CreateFile(tmp_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE)
+	{
+		log_printf(LOG_ERROR, "Cannot create %s: %s", tmp_path, w32_error(GetLastError()));
+		
+		free(header);
+		return false;
+	}
+	
+	DWORD written;
+	BOOL ok = WriteFile(file, header, size, &written, NULL) && written == size;
+	
+	if(!ok)
+	{
+		log_printf(LOG_ERROR, "Cannot write %s: %s", tmp_path, w32_error(GetLastError()));
+	}
+	
+	CloseHandle(file);
+	free(header);
+	
+	if(ok && !MoveFileEx(tmp_path, path, MOVEFILE_REPLACE_EXISTING))
+	{
+		log_printf(LOG_ERROR, "Cannot replace %s: %s", path, w32_error(GetLastError()));
+		ok = FALSE;
+	}
+	
+	if(!ok)
+	{
+		DeleteFile(tmp_path);
+		return false;
+	}
+	
+	log_printf(LOG_DEBUG, "Saved %u address cache entries to %s", (unsigned)(n_entries), path);
+	
+	return true;
+}
+
+/* Restore the entries in a snapshot written by addr_cache_save() which are
+ * still fresh and which valid() accepts. Time which passed since the snapshot
+ * was written counts against each entry, and every restored entry is treated
+ * as at least half way through its TTL, so stale peers are soon forgotten if
+ * they don't show up again.
+ *
+ * Returns false if the file is missing or isn't a compatible snapshot.
+*/
+bool addr_cache_load(const char *path, bool (*valid)(addr32_t net, addr48_t node, const struct sockaddr_in *addr, addr32_t iface_net, addr48_t iface_node))
+{
+	if(shared)
+	{
+		return false;
+	}
+	
+	HANDLE file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE)
+	{
+		DWORD error = GetLastError();
+		
+		if(error != ERROR_FILE_NOT_FOUND)
+		{
+			log_printf(LOG_WARNING, "Cannot open %s: %s", path, w32_error(error));
+		}
+		
+		return false;
+	}
+	
+	DWORD size = GetFileSize(file, NULL);
+	
+	if(size == INVALID_FILE_SIZE || size < sizeof(struct addr_cache_file_header))
+	{
+		log_printf(LOG_WARNING, "Ignoring truncated address cache snapshot %s", path);
+		
+		CloseHandle(file);
+		return false;
+	}
+	
+	HANDLE map = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	const struct addr_cache_file_header *header = map ? MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0) : NULL;
+	
+	if(!header)
+	{
+		log_printf(LOG_WARNING, "Cannot map %s: %s", path, w32_error(GetLastError()));
+		
+		if(map)
+		{
+			CloseHandle(map);
+		}
+		
+		CloseHandle(file);
+		return false;
+	}
+	
+	bool ok = header->magic == ADDR_CACHE_FILE_MAGIC
+		&& header->version == ADDR_CACHE_FILE_VERSION
+		&& header->entry_size == sizeof(struct addr_cache_entry)
+		&& header->n_entries <= (size - sizeof(*header)) / sizeof(struct addr_cache_entry);
+	
+	unsigned int restored = 0;
+	
+	if(ok)
+	{
+		const struct addr_cache_entry *entries = (const struct addr_cache_entry*)(header + 1);
+		
+		/* Time spent between processes, ignored if the clock went
+		 * backwards.
+		*/
+		
+		int32_t elapsed = cache_clock - header->saved_at;
+		if(elapsed < 0)
+		{
+			elapsed = 0;
+		}
+		
+		uint32_t min_age = cache_ttl / 2;
+		
+		for(uint32_t i = 0; i < header->n_entries; ++i)
+		{
+			const struct addr_cache_entry *entry = &(entries[i]);
+			
+			uint32_t age = entry->age + elapsed;
+			
+			if(age < entry->age || age >= cache_ttl)
+			{
+				continue;
+			}
+			
+			uint16_t sock;
+			memcpy(&sock, entry->socket, sizeof(sock));
+			
+			addr32_t net  = addr32_in(entry->net);
+			addr48_t node = addr48_in(entry->node);
+			
+			addr32_t iface_net  = addr32_in(entry->iface_net);
+			addr48_t iface_node = addr48_in(entry->iface_node);
+			
+			struct sockaddr_in addr;
+			memset(&addr, 0, sizeof(addr));
+			
+			addr.sin_family      = AF_INET;
+			addr.sin_addr.s_addr = entry->ipaddr;
+			addr.sin_port        = entry->port;
+			
+			if(valid && !valid(net, node, &addr, iface_net, iface_node))
+			{
+				continue;
+			}
+			
+			host_table_set(net, HOST_KEY(node, sock), entry->ipaddr, entry->port, iface_net, iface_node,
+				cache_clock - (age > min_age ? age : min_age));
+			
+			++restored;
+		}
+		
+		log_printf(LOG_INFO, "Restored %u of %u address cache entries from %s",
+			restored, (unsigned)(header->n_entries), path);
+	}
+	else{
+		log_printf(LOG_WARNING, "Ignoring incompatible address cache snapshot %s", path);
+	}
+	
+	UnmapViewOfFile(header);
+	CloseHandle(map);
+	CloseHandle(file);
+	
+	return ok;
 }
@@ -24,10 +24,135 @@
 
 #include "common.h"
 
+/* Default number of seconds an address remains valid after it was last seen,
+ * see addr_cache_set_ttl().
+*/
+#define ADDR_CACHE_TTL 30
+
+/* Maximum number of entries in the address cache, the least recently used
+ * entries are evicted to make room for new ones once it is full. Must be a
+ * power of two.
+*/
+#ifndef ADDR_CACHE_MAX_ENTRIES
+#define ADDR_CACHE_MAX_ENTRIES 4096
+#endif
+
+/* Maximum number of IP endpoints remembered for each IPX address. A host with
+ * several interfaces may be heard from through more than one of them.
+*/
+#define ADDR_CACHE_ENDPOINTS 3
+
+/* Private socket options for inspecting the address cache, alongside the
+ * router statistics options in router.h. Both are valid at the NSPROTO_IPX
+ * level on any IPX socket.
+ * 
+ * IPXWRAPPER_ADDR_CACHE_STATS returns a struct addr_cache_stats.
+ * 
+ * IPXWRAPPER_ADDR_CACHE_DUMP returns a dump of the address cache in the same
+ * format as a snapshot file, holding as many entries as fit in the buffer.
+ * optlen is set to the size needed to hold every entry.
+*/
+
+#define IPXWRAPPER_ADDR_CACHE_STATS 0x4F02
+#define IPXWRAPPER_ADDR_CACHE_DUMP  0x4F03
+
+/* Snapshot of the address cache written by addr_cache_save(). The file is a
+ * header followed by n_entries entries of entry_size bytes, with every field
+ * naturally aligned so the file can be mapped and read in place. IPX and IP
+ * addresses are in network byte order, everything else is little-endian.
+ * 
+ * Each endpoint of an IPX address is written as an entry of its own.
+*/
+#define ADDR_CACHE_FILE_MAGIC   0x43415049 /* "IPAC" */
+#define ADDR_CACHE_FILE_VERSION 2
+
+struct addr_cache_file_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t entry_size;
+	
+	/* Time the snapshot was written. */
+	uint32_t saved_at;
+	
+	uint32_t n_entries;
+};
+
+/* Entry has expired, only ever set in dumps. */
+#define ADDR_CACHE_ENTRY_EXPIRED  0x0001
+
+/* Entry is an ambiguous host default, only ever set in dumps. */
+#define ADDR_CACHE_ENTRY_CONFLICT 0x0002
+
+struct addr_cache_entry {
+	unsigned char net[4];
+	unsigned char node[6];
+	unsigned char socket[2];
+	
+	uint32_t ipaddr;
+	uint16_t port;
+	uint16_t flags;
+	
+	/* Seconds since the entry was last set, when the snapshot was
+	 * written.
+	*/
+	uint32_t age;
+	
+	/* Local IPX interface the address was last seen on. */
+	unsigned char iface_net[4];
+	unsigned char iface_node[6];
+	
+	uint16_t reserved;
+};
+
+struct addr_cache_stats {
+	/* Entries currently in the cache. */
+	uint64_t entries;
+	
+	/* Lookups which found an address, including those which fell back to
+	 * the host default.
+	*/
+	uint64_t hits;
+	
+	/* Lookups which found no usable address, so the packet had to be
+	 * broadcast. expired_misses counts those which only found an expired
+	 * address.
+	*/
+	uint64_t misses;
+	uint64_t expired_misses;
+	
+	/* Addresses added to the cache, and addresses set again while already
+	 * in it. Not counted when using the shared cache.
+	*/
+	uint64_t inserts;
+	uint64_t updates;
+	
+	/* Entries removed to make room for new ones. */
+	uint64_t evictions;
+	
+	/* Expired entries removed by the incremental sweep. */
+	uint64_t expired;
+	
+	/* Sends to a cached address which failed, each of which moves later
+	 * packets on to another endpoint of the same host if one is known.
+	*/
+	uint64_t send_failures;
+};
+
 void addr_cache_init(void);
+bool addr_cache_init_shared(void);
 void addr_cache_cleanup(void);
+void addr_cache_tick(void);
+void addr_cache_set_ttl(uint32_t ttl);
+
+int addr_cache_get(SOCKADDR_STORAGE *addr, size_t *addrlen, addr32_t net, addr48_t node, uint16_t sock, addr32_t iface_net, addr48_t iface_node);
+void addr_cache_set(const struct sockaddr *addr, size_t addrlen, addr32_t net, addr48_t node, uint16_t sock, addr32_t iface_net, addr48_t iface_node);
+void addr_cache_send_failed(const struct sockaddr *addr, size_t addrlen, addr32_t net, addr48_t node, uint16_t sock);
+
+void addr_cache_get_stats(struct addr_cache_stats *dest);
+
+size_t addr_cache_dump(void *buf, size_t size);
 
-int addr_cache_get(SOCKADDR_STORAGE *addr, size_t *addrlen, addr32_t net, addr48_t node, uint16_t sock);
-void addr_cache_set(const struct sockaddr *addr, size_t addrlen, addr32_t net, addr48_t node, uint16_t sock);
+bool addr_cache_save(const char *path);
+bool addr_cache_load(const char *path, bool (*valid)(addr32_t net, addr48_t node, const struct sockaddr_in *addr, addr32_t iface_net, addr48_t iface_node));
 
 #endif /* !_ADDRCACHE_H */
@@ -0,0 +1,382 @@
+/* IPXWrapper - Shared address table
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* Fixed size open addressing table of IPX address to sockaddr mappings, kept
+ * in a block of memory which may be mapped into several processes at once.
+ *
+ * The table has no pointers or locks, zeroed memory is an empty table. Each
+ * slot has a version counter which is odd while the slot is being written;
+ * writers claim a slot by incrementing its version with a compare-and-swap
+ * and readers retry their copy if the version changes underneath them.
+ *
+ * Slots are never emptied, expired ones are reused for new keys, so an unused
+ * slot always marks the end of a probe sequence. Since another process may
+ * die while holding a slot, nothing ever waits indefinitely for one: readers
+ * give up after ADDR_TABLE_READ_RETRIES and writers skip claimed slots. A slot
+ * which has stayed claimed for ttl seconds is taken to belong to a writer which
+ * died and is taken over by the next writer to probe it, until then readers
+ * skip it and its key may be written to a second slot.
+ *
+ * Nothing in here depends on Windows, so the table can be tested on any mapped
+ * file.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "addrtable.h"
+
+/* "IPA" followed by the layout version. */
+#define ADDR_TABLE_MAGIC 0x49504101
+
+#define ADDR_TABLE_READ_RETRIES 64
+#define ADDR_TABLE_SET_ATTEMPTS 8
+
+/* Number of times the version of a claimed slot must be seen unchanged before
+ * it may be taken over, see addr_table_stuck().
+*/
+#define ADDR_TABLE_STUCK_READS 64
+
+/* Returns the number of bytes needed to hold a table of n_slots slots. */
+size_t addr_table_size(uint32_t n_slots)
+{
+	return sizeof(struct addr_table_header) + ((size_t)(n_slots) * sizeof(struct addr_table_slot));
+}
+
+/* Attach to the table in a block of memory, which must either be zeroed or
+ * already contain a table of the same size. Returns false if the block holds
+ * an incompatible table or is too small.
+*/
+bool addr_table_attach(addr_table_t *table, void *mem, size_t size)
+{
+	if(size < addr_table_size(1))
+	{
+		return false;
+	}
+	
+	struct addr_table_header *header = mem;
+	uint32_t n_slots = (size - sizeof(struct addr_table_header)) / sizeof(struct addr_table_slot);
+	
+	__sync_val_compare_and_swap(&(header->n_slots), 0, n_slots);
+	__sync_val_compare_and_swap(&(header->magic), 0, ADDR_TABLE_MAGIC);
+	
+	if(header->magic != ADDR_TABLE_MAGIC || header->n_slots != n_slots)
+	{
+		return false;
+	}
+	
+	table->header  = header;
+	table->slots   = (struct addr_table_slot*)(header + 1);
+	table->n_slots = n_slots;
+	
+	return true;
+}
+
+/* Age of a slot in seconds. Each process keeps its own clock, so a slot may
+ * have been written slightly in the future.
+*/
+static int32_t addr_table_age(const struct addr_table_slot *slot, uint32_t now)
+{
+	return (int32_t)(now - slot->time);
+}
+
+static uint32_t addr_table_hash(addr32_t net, addr48_t node, uint16_t sock)
+{
+	uint64_t hash = ((uint64_t)(net) * 0x9E3779B97F4A7C15ULL)
+		^ (node * 0xC2B2AE3D27D4EB4FULL)
+		^ ((uint64_t)(sock) * 0x165667B19E3779F9ULL);
+	
+	return hash ^ (hash >> 32);
+}
+
+static bool addr_table_slot_is(const struct addr_table_slot *slot, addr32_t net, addr48_t node, uint16_t sock)
+{
+	return slot->used && slot->net == net && slot->node == node && slot->sock == sock;
+}
+
+/* Take a consistent copy of a slot. Returns false if it was being written for
+ * the whole time.
+*/
+static bool addr_table_read_slot(const struct addr_table_slot *slot, struct addr_table_slot *copy)
+{
+	for(int i = 0; i < ADDR_TABLE_READ_RETRIES; ++i)
+	{
+		uint32_t version = slot->version;
+		
+		if(version & 1)
+		{
+			continue;
+		}
+		
+		__sync_synchronize();
+		
+		memcpy(copy, (const void*)(slot), sizeof(*copy));
+		
+		__sync_synchronize();
+		
+		if(slot->version == version)
+		{
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+/* Check whether a claimed slot was left behind by a writer which died part way
+ * through writing it. The version must stay the same while it is read several
+ * times and the slot must have been claimed at least ttl seconds ago, which no
+ * live writer takes.
+*/
+static bool addr_table_stuck(const struct addr_table_slot *slot, uint32_t version, uint32_t now, uint32_t ttl)
+{
+	for(int i = 0; i < ADDR_TABLE_STUCK_READS; ++i)
+	{
+		if(slot->version != version)
+		{
+			return false;
+		}
+	}
+	
+	return (int32_t)(now - slot->claim_time) >= (int32_t)(ttl);
+}
+
+/* Claim a slot for writing, taking it over if it was left claimed by a writer
+ * which died. Stores the version to release the slot with, less two, in
+ * *version. Returns false if someone else is writing the slot.
+*/
+static bool addr_table_claim(struct addr_table_slot *slot, uint32_t now, uint32_t ttl, uint32_t *version)
+{
+	uint32_t v = slot->version;
+	
+	if(v & 1)
+	{
+		/* Keep the version odd so readers still skip the slot. */
+		
+		if(!addr_table_stuck(slot, v, now, ttl) || !__sync_bool_compare_and_swap(&(slot->version), v, v + 2))
+		{
+			return false;
+		}
+		
+		*version = v + 1;
+	}
+	else{
+		if(!__sync_bool_compare_and_swap(&(slot->version), v, v + 1))
+		{
+			return false;
+		}
+		
+		*version = v;
+	}
+	
+	__sync_synchronize();
+	
+	slot->claim_time = now;
+	
+	return true;
+}
+
+/* Look up the address of an IPX address. Returns false if the key isn't in
+ * the table, the caller is responsible for checking the age of the address.
+ *
+ * Never blocks.
+*/
+bool addr_table_get(const addr_table_t *table, addr32_t net, addr48_t node, uint16_t sock, struct addr_table_value *value)
+{
+	uint32_t start = addr_table_hash(net, node, sock) % table->n_slots;
+	
+	for(uint32_t i = 0; i < ADDR_TABLE_MAX_PROBE && i < table->n_slots; ++i)
+	{
+		struct addr_table_slot copy;
+		
+		if(!addr_table_read_slot(&(table->slots[(start + i) % table->n_slots]), &copy))
+		{
+			continue;
+		}
+		
+		if(!copy.used)
+		{
+			break;
+		}
+		
+		if(addr_table_slot_is(&copy, net, node, sock) && copy.addrlen <= ADDR_TABLE_ADDR_MAX)
+		{
+			value->time          = copy.time;
+			value->conflict      = copy.conflict;
+			value->conflict_time = copy.conflict_time;
+			value->addrlen       = copy.addrlen;
+			
+			memcpy(value->addr, copy.addr, copy.addrlen);
+			
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+/* Copy the key and address in a slot of the table, for walking every address
+ * in it. Returns false if the slot is unused or is being written.
+*/
+bool addr_table_get_slot(const addr_table_t *table, uint32_t index, addr32_t *net, addr48_t *node, uint16_t *sock, struct addr_table_value *value)
+{
+	struct addr_table_slot copy;
+	
+	if(index >= table->n_slots
+		|| !addr_table_read_slot(&(table->slots[index]), &copy)
+		|| !copy.used
+		|| copy.addrlen > ADDR_TABLE_ADDR_MAX)
+	{
+		return false;
+	}
+	
+	*net  = copy.net;
+	*node = copy.node;
+	*sock = copy.sock;
+	
+	value->time          = copy.time;
+	value->conflict      = copy.conflict;
+	value->conflict_time = copy.conflict_time;
+	value->addrlen       = copy.addrlen;
+	
+	memcpy(value->addr, copy.addr, copy.addrlen);
+	
+	return true;
+}
+
+/* Store the address of an IPX address. Slots whose address is ttl or more
+ * seconds older than now may be reused, or the oldest slot in the key's probe
+ * sequence if there are none. Changing the address of a key which is still
+ * fresh is recorded as a conflict.
+ *
+ * Returns false if the address is too large or every slot the key could use
+ * is being written by someone else.
+*/
+bool addr_table_set(addr_table_t *table, addr32_t net, addr48_t node, uint16_t sock, const void *addr, size_t addrlen, uint32_t now, uint32_t ttl)
+{
+	if(addrlen > ADDR_TABLE_ADDR_MAX)
+	{
+		return false;
+	}
+	
+	uint32_t start = addr_table_hash(net, node, sock) % table->n_slots;
+	
+	for(int attempt = 0; attempt < ADDR_TABLE_SET_ATTEMPTS; ++attempt)
+	{
+		/* Pick a slot without claiming anything, the choice is checked
+		 * again once the slot is claimed.
+		*/
+		
+		struct addr_table_slot *match = NULL, *unused = NULL, *oldest = NULL;
+		
+		for(uint32_t i = 0; i < ADDR_TABLE_MAX_PROBE && i < table->n_slots; ++i)
+		{
+			struct addr_table_slot *slot = &(table->slots[(start + i) % table->n_slots]);
+			
+			uint32_t version = slot->version;
+			
+			if((version & 1) && !addr_table_stuck(slot, version, now, ttl))
+			{
+				continue;
+			}
+			
+			if(!slot->used)
+			{
+				if(!unused)
+				{
+					unused = slot;
+				}
+				
+				break;
+			}
+			
+			if(addr_table_slot_is(slot, net, node, sock))
+			{
+				match = slot;
+				break;
+			}
+			
+			if(!unused && addr_table_age(slot, now) >= (int32_t)(ttl))
+			{
+				unused = slot;
+			}
+			
+			if(!oldest || addr_table_age(slot, now) > addr_table_age(oldest, now))
+			{
+				oldest = slot;
+			}
+		}
+		
+		struct addr_table_slot *slot = match ? match : (unused ? unused : oldest);
+		
+		if(!slot)
+		{
+			return false;
+		}
+		
+		uint32_t version;
+		
+		if(!addr_table_claim(slot, now, ttl, &version))
+		{
+			continue;
+		}
+		
+		bool is_match = addr_table_slot_is(slot, net, node, sock);
+		
+		if((slot == match && !is_match)
+			|| (slot == unused && !is_match && slot->used && addr_table_age(slot, now) < (int32_t)(ttl)))
+		{
+			/* Someone else got to the slot first. */
+			
+			__sync_synchronize();
+			slot->version = version + 2;
+			
+			continue;
+		}
+		
+		if(!is_match)
+		{
+			slot->net      = net;
+			slot->node     = node;
+			slot->sock     = sock;
+			slot->used     = 1;
+			slot->conflict = 0;
+		}
+		else if(slot->addrlen != addrlen || memcmp(slot->addr, addr, addrlen) != 0)
+		{
+			if(addr_table_age(slot, now) < (int32_t)(ttl))
+			{
+				slot->conflict      = 1;
+				slot->conflict_time = now;
+			}
+		}
+		
+		memcpy(slot->addr, addr, addrlen);
+		slot->addrlen = addrlen;
+		
+		slot->time = now;
+		
+		__sync_synchronize();
+		slot->version = version + 2;
+		
+		return true;
+	}
+	
+	return false;
+}
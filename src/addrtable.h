@@ -0,0 +1,100 @@
+/* IPXWrapper - Shared address table
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef IPXWRAPPER_ADDRTABLE_H
+#define IPXWRAPPER_ADDRTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "addr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Largest address which can be stored in a slot. */
+#define ADDR_TABLE_ADDR_MAX 32
+
+/* Number of slots searched for a key, starting at its hash. */
+#define ADDR_TABLE_MAX_PROBE 16
+
+struct addr_table_header
+{
+	volatile uint32_t magic;
+	volatile uint32_t n_slots;
+	
+	uint32_t reserved[2];
+};
+
+struct addr_table_slot
+{
+	addr48_t node;
+	addr32_t net;
+	uint16_t sock;
+	uint8_t used;
+	uint8_t conflict;
+	
+	/* Odd while the slot is being written. */
+	volatile uint32_t version;
+	
+	/* Time the slot was last claimed for writing. */
+	uint32_t claim_time;
+	
+	uint32_t time;
+	uint32_t conflict_time;
+	
+	uint32_t addrlen;
+	unsigned char addr[ADDR_TABLE_ADDR_MAX];
+};
+
+typedef struct addr_table
+{
+	struct addr_table_header *header;
+	struct addr_table_slot *slots;
+	
+	uint32_t n_slots;
+} addr_table_t;
+
+struct addr_table_value
+{
+	/* Time the address was last set. */
+	uint32_t time;
+	
+	/* Time the address was last changed while less than ttl seconds old,
+	 * only valid if conflict is true.
+	*/
+	bool conflict;
+	uint32_t conflict_time;
+	
+	size_t addrlen;
+	unsigned char addr[ADDR_TABLE_ADDR_MAX];
+};
+
+size_t addr_table_size(uint32_t n_slots);
+bool addr_table_attach(addr_table_t *table, void *mem, size_t size);
+
+bool addr_table_get(const addr_table_t *table, addr32_t net, addr48_t node, uint16_t sock, struct addr_table_value *value);
+bool addr_table_get_slot(const addr_table_t *table, uint32_t index, addr32_t *net, addr48_t *node, uint16_t *sock, struct addr_table_value *value);
+bool addr_table_set(addr_table_t *table, addr32_t net, addr48_t node, uint16_t sock, const void *addr, size_t addrlen, uint32_t now, uint32_t ttl);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !IPXWRAPPER_ADDRTABLE_H */
@@ -18,6 +18,7 @@
 #include <stdio.h>
 
 #include "config.h"
+#include "addrcache.h"
 #include "common.h"
 #include "interface.h"
 
@@ -27,12 +28,20 @@ main_config_t get_main_config(void)
 	
 	main_config_t config;
 	
-	config.udp_port   = DEFAULT_PORT;
-	config.w95_bug    = true;
-	config.fw_except  = false;
-	config.use_pcap   = false;
-	config.frame_type = FRAME_TYPE_ETH_II;
-	config.log_level  = LOG_INFO;
+	config.udp_port      = DEFAULT_PORT;
+	config.w95_bug       = true;
+	config.fw_except     = false;
+	config.use_pcap      = false;
+	config.frame_type    = FRAME_TYPE_ETH_II;
+	config.router_batch  = DEFAULT_ROUTER_BATCH;
+	config.router_engine = ROUTER_ENGINE_EVENT;
+	config.ring_delivery = false;
+	config.shared_router = false;
+	config.shared_addr_cache  = false;
+	config.announce_interval  = 0;
+	config.addr_cache_ttl     = ADDR_CACHE_TTL;
+	config.persist_addr_cache = false;
+	config.log_level     = LOG_INFO;
 	
 	HKEY reg = reg_open_main(false);
 	
@@ -57,6 +66,16 @@ main_config_t get_main_config(void)
 	config.frame_type = reg_get_dword(reg, "frame_type", config.frame_type);
 	config.log_level  = reg_get_dword(reg, "log_level",  config.log_level);
 	
+	config.router_batch  = reg_get_dword(reg, "router_batch",  config.router_batch);
+	config.router_engine = reg_get_dword(reg, "router_engine", config.router_engine);
+	config.ring_delivery = reg_get_dword(reg, "ring_delivery", config.ring_delivery);
+	config.shared_router = reg_get_dword(reg, "shared_router", config.shared_router);
+	
+	config.shared_addr_cache  = reg_get_dword(reg, "shared_addr_cache",  config.shared_addr_cache);
+	config.announce_interval  = reg_get_dword(reg, "announce_interval",  config.announce_interval);
+	config.addr_cache_ttl     = reg_get_dword(reg, "addr_cache_ttl",     config.addr_cache_ttl);
+	config.persist_addr_cache = reg_get_dword(reg, "persist_addr_cache", config.persist_addr_cache);
+	
 	/* Check for valid frame_type */
 	
 	if(        config.frame_type != FRAME_TYPE_ETH_II
@@ -70,6 +89,33 @@ main_config_t get_main_config(void)
 		config.frame_type = FRAME_TYPE_ETH_II;
 	}
 	
+	if(config.router_batch == 0)
+	{
+		log_printf(LOG_WARNING, "Ignoring invalid router_batch 0");
+		config.router_batch = DEFAULT_ROUTER_BATCH;
+	}
+	
+	if(        config.router_engine != ROUTER_ENGINE_EVENT
+		&& config.router_engine != ROUTER_ENGINE_IOCP)
+	{
+		log_printf(LOG_WARNING, "Ignoring unknown router_engine %u",
+			(unsigned int)(config.router_engine));
+		
+		config.router_engine = ROUTER_ENGINE_EVENT;
+	}
+	
+	if(config.addr_cache_ttl == 0)
+	{
+		log_printf(LOG_WARNING, "Ignoring invalid addr_cache_ttl 0");
+		config.addr_cache_ttl = ADDR_CACHE_TTL;
+	}
+	
+	if(config.announce_interval != 0 && config.announce_interval >= config.addr_cache_ttl)
+	{
+		log_printf(LOG_WARNING, "announce_interval %u isn't shorter than addr_cache_ttl %u, peers will forget this host between announcements",
+			config.announce_interval, config.addr_cache_ttl);
+	}
+	
 	reg_close(reg);
 	
 	return config;
@@ -84,7 +130,17 @@ bool set_main_config(const main_config_t *config)
 		&& reg_set_dword(reg, "fw_except",  config->fw_except)
 		&& reg_set_dword(reg, "use_pcap",   config->use_pcap)
 		&& reg_set_dword(reg, "frame_type", config->frame_type)
-		&& reg_set_dword(reg, "log_level",  config->log_level);
+		&& reg_set_dword(reg, "log_level",  config->log_level)
+		
+		&& reg_set_dword(reg, "router_batch",  config->router_batch)
+		&& reg_set_dword(reg, "router_engine", config->router_engine)
+		&& reg_set_dword(reg, "ring_delivery", config->ring_delivery)
+		&& reg_set_dword(reg, "shared_router", config->shared_router)
+		
+		&& reg_set_dword(reg, "shared_addr_cache",  config->shared_addr_cache)
+		&& reg_set_dword(reg, "announce_interval",  config->announce_interval)
+		&& reg_set_dword(reg, "addr_cache_ttl",     config->addr_cache_ttl)
+		&& reg_set_dword(reg, "persist_addr_cache", config->persist_addr_cache);
 	
 	reg_close(reg);
 	
@@ -19,6 +19,7 @@
 #define IPX_CONFIG_H
 
 #define DEFAULT_PORT 54792
+#define DEFAULT_ROUTER_BATCH 64
 
 #include "common.h"
 
@@ -33,6 +34,12 @@ enum main_config_frame_type
 	FRAME_TYPE_LLC    = 3,
 };
 
+enum main_config_router_engine
+{
+	ROUTER_ENGINE_EVENT = 1,
+	ROUTER_ENGINE_IOCP  = 2,
+};
+
 typedef struct main_config {
 	uint16_t udp_port;
 	
@@ -41,6 +48,48 @@ typedef struct main_config {
 	bool use_pcap;
 	enum main_config_frame_type frame_type;
 	
+	/* Maximum number of datagrams the router will read from each UDP
+	 * socket before moving on to the next one.
+	*/
+	unsigned int router_batch;
+	
+	/* Method used by the router thread to wait for UDP packets, ignored
+	 * when using WinPcap.
+	*/
+	enum main_config_router_engine router_engine;
+	
+	/* Deliver packets to IPX sockets through an in-process ring rather
+	 * than relaying them over loopback.
+	*/
+	bool ring_delivery;
+	
+	/* Share one router between every process using the same UDP port,
+	 * the first process to start owns the port and relays packets on to
+	 * the others. Ignored when using WinPcap.
+	*/
+	bool shared_router;
+	
+	/* Keep the address cache in shared memory, so every process on the
+	 * host uses addresses learned by any of them.
+	*/
+	bool shared_addr_cache;
+	
+	/* Seconds between IPX_MAGIC_ANNOUNCE broadcasts advertising the
+	 * sockets bound by this process, zero to disable them.
+	*/
+	unsigned int announce_interval;
+	
+	/* Seconds an address learned from the network remains in the address
+	 * cache.
+	*/
+	unsigned int addr_cache_ttl;
+	
+	/* Save the address cache to a file in the working directory when the
+	 * process exits and restore it at startup, so a restarted game can
+	 * reach its peers without broadcasting first.
+	*/
+	bool persist_addr_cache;
+	
 	enum ipx_log_level log_level;
 } main_config_t;
 
@@ -0,0 +1,270 @@
+/* IPXWrapper - Epoch based reclamation
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* Readers wrap any access to shared objects in epoch_enter()/epoch_leave()
+ * without taking any locks. Writers swap in a replacement object and pass the
+ * old one to epoch_retire(), which defers freeing it until no reader which
+ * could have seen it is still inside a read section.
+ * 
+ * Each thread claims a reader slot on its first epoch_enter() call and holds
+ * it until it exits. If every slot is taken, the thread falls back to holding
+ * epoch_cs for the duration of its read sections instead, which excludes it
+ * from running at the same time as any reclamation.
+ * 
+ * Read sections cannot be nested, and epoch_retire() must not be called from
+ * within one.
+*/
+
+#include <windows.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <utlist.h>
+
+#include "epoch.h"
+#include "common.h"
+
+#define EPOCH_MAX_READERS 32
+
+struct epoch_reader
+{
+	/* Non-zero while claimed by a thread. */
+	volatile LONG claimed;
+	
+	/* Epoch at which the current read section began, zero when the
+	 * owning thread isn't in a read section.
+	*/
+	volatile LONG epoch;
+};
+
+struct epoch_garbage
+{
+	void *ptr;
+	void (*free_func)(void*);
+	
+	LONG epoch;
+	
+	struct epoch_garbage *next;
+};
+
+static struct epoch_reader readers[EPOCH_MAX_READERS];
+
+/* Stored in a thread's TLS slot when no reader slot was available. */
+static struct epoch_reader fallback_reader;
+
+static DWORD reader_tls = TLS_OUT_OF_INDEXES;
+
+static volatile LONG global_epoch = 1;
+
+/* Objects waiting to be freed, protected by epoch_cs. */
+static struct epoch_garbage *garbage = NULL;
+static CRITICAL_SECTION epoch_cs;
+
+void epoch_init(void)
+{
+	if((reader_tls = TlsAlloc()) == TLS_OUT_OF_INDEXES)
+	{
+		log_printf(LOG_ERROR, "Failed to allocate TLS index: %s", w32_error(GetLastError()));
+		abort();
+	}
+	
+	if(!InitializeCriticalSectionAndSpinCount(&epoch_cs, 0x80000000))
+	{
+		log_printf(LOG_ERROR, "Failed to initialise critical section: %s", w32_error(GetLastError()));
+		abort();
+	}
+}
+
+/* Free any remaining retired objects. No threads may be in a read section. */
+void epoch_cleanup(void)
+{
+	struct epoch_garbage *g, *tmp;
+	
+	LL_FOREACH_SAFE(garbage, g, tmp)
+	{
+		LL_DELETE(garbage, g);
+		
+		g->free_func(g->ptr);
+		free(g);
+	}
+	
+	DeleteCriticalSection(&epoch_cs);
+	
+	TlsFree(reader_tls);
+	reader_tls = TLS_OUT_OF_INDEXES;
+}
+
+/* Release the reader slot held by the calling thread, if any. Called when a
+ * thread exits.
+*/
+void epoch_thread_exit(void)
+{
+	if(reader_tls == TLS_OUT_OF_INDEXES)
+	{
+		return;
+	}
+	
+	struct epoch_reader *reader = TlsGetValue(reader_tls);
+	
+	if(reader && reader != &fallback_reader)
+	{
+		InterlockedExchange(&(reader->epoch), 0);
+		InterlockedExchange(&(reader->claimed), 0);
+	}
+	
+	TlsSetValue(reader_tls, NULL);
+}
+
+static struct epoch_reader *_get_reader(void)
+{
+	struct epoch_reader *reader = TlsGetValue(reader_tls);
+	
+	if(!reader)
+	{
+		reader = &fallback_reader;
+		
+		for(int i = 0; i < EPOCH_MAX_READERS; ++i)
+		{
+			if(InterlockedCompareExchange(&(readers[i].claimed), 1, 0) == 0)
+			{
+				reader = &(readers[i]);
+				break;
+			}
+		}
+		
+		if(reader == &fallback_reader)
+		{
+			log_printf(LOG_WARNING, "No free epoch reader slots, thread %u will use locking",
+				(unsigned int)(GetCurrentThreadId()));
+		}
+		
+		TlsSetValue(reader_tls, reader);
+	}
+	
+	return reader;
+}
+
+/* Begin a read section. Any object retired after this point will not be freed
+ * until the matching epoch_leave() call.
+*/
+void epoch_enter(void)
+{
+	struct epoch_reader *reader = _get_reader();
+	
+	if(reader == &fallback_reader)
+	{
+		EnterCriticalSection(&epoch_cs);
+	}
+	else{
+		/* InterlockedExchange() is a full barrier, so the epoch is
+		 * published before the caller reads any shared pointers.
+		*/
+		
+		InterlockedExchange(&(reader->epoch), global_epoch);
+	}
+}
+
+void epoch_leave(void)
+{
+	struct epoch_reader *reader = TlsGetValue(reader_tls);
+	
+	if(reader == &fallback_reader)
+	{
+		LeaveCriticalSection(&epoch_cs);
+	}
+	else{
+		InterlockedExchange(&(reader->epoch), 0);
+	}
+}
+
+/* Returns the oldest epoch any reader is currently in, LONG_MAX if none. */
+static LONG _min_active_epoch(void)
+{
+	LONG min = LONG_MAX;
+	
+	for(int i = 0; i < EPOCH_MAX_READERS; ++i)
+	{
+		LONG epoch = readers[i].epoch;
+		
+		if(epoch != 0 && epoch < min)
+		{
+			min = epoch;
+		}
+	}
+	
+	return min;
+}
+
+/* Free any retired objects which no reader can still be using. Must be called
+ * with epoch_cs held.
+*/
+static void _collect(void)
+{
+	LONG min = _min_active_epoch();
+	
+	struct epoch_garbage *g, *tmp;
+	
+	LL_FOREACH_SAFE(garbage, g, tmp)
+	{
+		if(g->epoch < min)
+		{
+			LL_DELETE(garbage, g);
+			
+			g->free_func(g->ptr);
+			free(g);
+		}
+	}
+}
+
+/* Free an object once every reader which may have obtained a pointer to it has
+ * left its read section. The object must already be unreachable to any new
+ * readers.
+*/
+void epoch_retire(void *ptr, void (*free_func)(void*))
+{
+	EnterCriticalSection(&epoch_cs);
+	
+	/* Readers which enter after the increment can't have seen the object,
+	 * only those still in this epoch or an older one need waiting for.
+	*/
+	
+	LONG epoch = InterlockedIncrement(&global_epoch) - 1;
+	
+	struct epoch_garbage *g = malloc(sizeof(struct epoch_garbage));
+	
+	if(g)
+	{
+		g->ptr       = ptr;
+		g->free_func = free_func;
+		g->epoch     = epoch;
+		
+		LL_PREPEND(garbage, g);
+	}
+	else{
+		/* Can't defer it, wait for the readers to leave instead. */
+		
+		while(_min_active_epoch() <= epoch)
+		{
+			Sleep(0);
+		}
+		
+		free_func(ptr);
+	}
+	
+	_collect();
+	
+	LeaveCriticalSection(&epoch_cs);
+}
@@ -0,0 +1,38 @@
+/* IPXWrapper - Epoch based reclamation
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef IPXWRAPPER_EPOCH_H
+#define IPXWRAPPER_EPOCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void epoch_init(void);
+void epoch_cleanup(void);
+void epoch_thread_exit(void);
+
+void epoch_enter(void);
+void epoch_leave(void);
+
+void epoch_retire(void *ptr, void (*free_func)(void*));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !IPXWRAPPER_EPOCH_H */
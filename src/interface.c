@@ -36,6 +36,24 @@ static CRITICAL_SECTION interface_cache_cs;
 static ipx_interface_t *interface_cache = NULL;
 static time_t interface_cache_ctime = 0;
 
+/* Flattened copy of the IP subnets of each interface in the cache, used for
+ * validating the source address of inbound packets without copying the cache.
+ * Rebuilt whenever the cache is reloaded, protected by interface_cache_cs.
+*/
+
+struct ipx_subnet {
+	uint32_t ipaddr;
+	uint32_t network;
+	uint32_t netmask;
+	uint32_t bcast;
+	
+	addr32_t ipx_net;
+	addr48_t ipx_node;
+};
+
+static struct ipx_subnet *subnet_table = NULL;
+static size_t subnet_count = 0;
+
 /* Fetch a list of network interfaces available on the system.
  *
  * Returns a linked list of IP_ADAPTER_INFO structures, all allocated within a
@@ -564,6 +582,61 @@ void ipx_interfaces_cleanup(void)
 	}
 	
 	free_ipx_interface_list(&interface_cache);
+	
+	free(subnet_table);
+	subnet_table = NULL;
+	subnet_count = 0;
+}
+
+/* Rebuild subnet_table from the interface cache.
+ * Ensure you hold interface_cache_cs before calling.
+*/
+static void _rebuild_subnet_table(void)
+{
+	free(subnet_table);
+	subnet_table = NULL;
+	subnet_count = 0;
+	
+	size_t count = 0;
+	
+	ipx_interface_t *iface;
+	ipx_interface_ip_t *ip;
+	
+	DL_FOREACH(interface_cache, iface)
+	{
+		DL_FOREACH(iface->ipaddr, ip)
+		{
+			++count;
+		}
+	}
+	
+	if(count == 0)
+	{
+		return;
+	}
+	
+	if(!(subnet_table = malloc(count * sizeof(struct ipx_subnet))))
+	{
+		log_printf(LOG_ERROR, "Cannot allocate subnet table!");
+		log_printf(LOG_WARNING, "Inbound packets will be dropped until the interface cache is reloaded");
+		
+		return;
+	}
+	
+	DL_FOREACH(interface_cache, iface)
+	{
+		DL_FOREACH(iface->ipaddr, ip)
+		{
+			struct ipx_subnet *subnet = &(subnet_table[subnet_count++]);
+			
+			subnet->ipaddr   = ip->ipaddr;
+			subnet->network  = ip->ipaddr & ip->netmask;
+			subnet->netmask  = ip->netmask;
+			subnet->bcast    = ip->bcast;
+			subnet->ipx_net  = iface->ipx_net;
+			subnet->ipx_node = iface->ipx_node;
+		}
+	}
 }
 
 /* Check the age of the IPX interface cache and reload it if necessary.
@@ -585,6 +658,8 @@ static void renew_interface_cache(void)
 		
 		interface_cache       = load_ipx_interfaces();
 		interface_cache_ctime = time(NULL);
+		
+		_rebuild_subnet_table();
 	}
 }
 
@@ -629,6 +704,60 @@ ipx_interface_t *ipx_interface_by_addr(addr32_t net, addr48_t node)
 	return iface;
 }
 
+/* Check if an IPX interface with the given address exists, without copying
+ * it like ipx_interface_by_addr() does.
+*/
+bool ipx_interface_exists(addr32_t net, addr48_t node)
+{
+	EnterCriticalSection(&interface_cache_cs);
+	
+	renew_interface_cache();
+	
+	bool found = false;
+	
+	ipx_interface_t *iface;
+	
+	DL_FOREACH(interface_cache, iface)
+	{
+		if(iface->ipx_net == net && iface->ipx_node == node)
+		{
+			found = true;
+			break;
+		}
+	}
+	
+	LeaveCriticalSection(&interface_cache_cs);
+	
+	return found;
+}
+
+/* Search for the WinPcap handle of an IPX interface by address without
+ * copying the interface. Only valid when WinPcap is in use, the interfaces
+ * and their handles are then kept until ipx_interfaces_cleanup().
+ * Returns NULL if the interface doesn't exist.
+*/
+pcap_t *ipx_interface_pcap_by_addr(addr32_t net, addr48_t node)
+{
+	EnterCriticalSection(&interface_cache_cs);
+	
+	pcap_t *pcap = NULL;
+	
+	ipx_interface_t *iface;
+	
+	DL_FOREACH(interface_cache, iface)
+	{
+		if(iface->ipx_net == net && iface->ipx_node == node)
+		{
+			pcap = iface->pcap;
+			break;
+		}
+	}
+	
+	LeaveCriticalSection(&interface_cache_cs);
+	
+	return pcap;
+}
+
 /* Search for an IPX interface by associated IP subnet.
  * Returns NULL if no interfaces match or on malloc failure.
 */
@@ -660,6 +789,101 @@ ipx_interface_t *ipx_interface_by_subnet(uint32_t ipaddr)
 	return iface;
 }
 
+/* Check whether an IP address is within a subnet of the IPX interface with the
+ * given address, or of any interface if any_iface is true. The address of the
+ * matching interface is stored in iface_net and iface_node.
+ * 
+ * Unlike the ipx_interface_by_XXX() functions, this doesn't allocate memory.
+*/
+bool ipx_interface_has_subnet(uint32_t ipaddr, bool any_iface, addr32_t net, addr48_t node, addr32_t *iface_net, addr48_t *iface_node)
+{
+	EnterCriticalSection(&interface_cache_cs);
+	
+	renew_interface_cache();
+	
+	bool found = false;
+	
+	for(size_t i = 0; i < subnet_count; ++i)
+	{
+		const struct ipx_subnet *subnet = &(subnet_table[i]);
+		
+		if((ipaddr & subnet->netmask) == subnet->network
+			&& (any_iface || (subnet->ipx_net == net && subnet->ipx_node == node)))
+		{
+			*iface_net  = subnet->ipx_net;
+			*iface_node = subnet->ipx_node;
+			
+			found = true;
+			break;
+		}
+	}
+	
+	LeaveCriticalSection(&interface_cache_cs);
+	
+	return found;
+}
+
+/* Check whether an IP address is assigned to one of the IPX interfaces, or is
+ * the loopback address. Doesn't allocate memory.
+*/
+bool ipx_interface_is_local_ip(uint32_t ipaddr)
+{
+	if(ipaddr == htonl(INADDR_LOOPBACK))
+	{
+		return true;
+	}
+	
+	EnterCriticalSection(&interface_cache_cs);
+	
+	renew_interface_cache();
+	
+	bool found = false;
+	
+	for(size_t i = 0; i < subnet_count; ++i)
+	{
+		if(subnet_table[i].ipaddr == ipaddr)
+		{
+			found = true;
+			break;
+		}
+	}
+	
+	LeaveCriticalSection(&interface_cache_cs);
+	
+	return found;
+}
+
+/* Copy the broadcast address of each IP address of the IPX interface with the
+ * given address to bcast, stopping after max addresses. Returns the number of
+ * IP addresses the interface has, which may be more than max, or zero if the
+ * interface doesn't exist or has no IP addresses. Doesn't allocate memory.
+*/
+int ipx_interface_bcast_addrs(addr32_t net, addr48_t node, uint32_t *bcast, int max)
+{
+	EnterCriticalSection(&interface_cache_cs);
+	
+	renew_interface_cache();
+	
+	int n = 0;
+	
+	for(size_t i = 0; i < subnet_count; ++i)
+	{
+		if(subnet_table[i].ipx_net == net && subnet_table[i].ipx_node == node)
+		{
+			if(n < max)
+			{
+				bcast[n] = subnet_table[i].bcast;
+			}
+			
+			++n;
+		}
+	}
+	
+	LeaveCriticalSection(&interface_cache_cs);
+	
+	return n;
+}
+
 /* Search for an IPX interface by index.
  * Returns NULL if the interface doesn't exist or malloc failure.
 */
@@ -91,8 +91,13 @@ void ipx_interfaces_cleanup(void);
 
 ipx_interface_t *get_ipx_interfaces(void);
 ipx_interface_t *ipx_interface_by_addr(addr32_t net, addr48_t node);
+pcap_t *ipx_interface_pcap_by_addr(addr32_t net, addr48_t node);
+bool ipx_interface_exists(addr32_t net, addr48_t node);
 ipx_interface_t *ipx_interface_by_subnet(uint32_t ipaddr);
 ipx_interface_t *ipx_interface_by_index(int index);
+bool ipx_interface_has_subnet(uint32_t ipaddr, bool any_iface, addr32_t net, addr48_t node, addr32_t *iface_net, addr48_t *iface_node);
+bool ipx_interface_is_local_ip(uint32_t ipaddr);
+int ipx_interface_bcast_addrs(addr32_t net, addr48_t node, uint32_t *bcast, int max);
 int ipx_interface_count(void);
 
 ipx_pcap_interface_t *ipx_get_pcap_interfaces(void);
@@ -0,0 +1,48 @@
+/* IPXWrapper - IPX over UDP packet encoding
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <winsock2.h>
+
+#include <stdint.h>
+
+#include "addr.h"
+#include "ipxpacket.h"
+
+/* Serialise the header of an ipx_packet, leaving the payload untouched so it
+ * can be sent straight from the caller's buffer.
+ * 
+ * header must point to at least IPX_PACKET_HEADER_SIZE bytes. Socket numbers
+ * are in network byte order, payload_len must not exceed 65535.
+*/
+void ipx_packet_header_pack(ipx_packet *header,
+	uint8_t type,
+	addr32_t src_net,  addr48_t src_node,  uint16_t src_socket,
+	addr32_t dst_net, addr48_t dst_node, uint16_t dst_socket,
+	size_t payload_len)
+{
+	header->ptype = type;
+	
+	addr32_out(header->dest_net, dst_net);
+	addr48_out(header->dest_node, dst_node);
+	header->dest_socket = dst_socket;
+	
+	addr32_out(header->src_net, src_net);
+	addr48_out(header->src_node, src_node);
+	header->src_socket = src_socket;
+	
+	header->size = htons(payload_len);
+}
@@ -0,0 +1,64 @@
+/* IPXWrapper - IPX over UDP packet encoding
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef IPXWRAPPER_IPXPACKET_H
+#define IPXWRAPPER_IPXPACKET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "addr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* An IPX packet as encapsulated in a UDP datagram, either on the network or
+ * when relayed to a local socket. All fields are in network byte order.
+*/
+
+typedef struct ipx_packet ipx_packet;
+
+struct ipx_packet {
+	uint8_t ptype;
+	
+	unsigned char dest_net[4];
+	unsigned char dest_node[6];
+	uint16_t dest_socket;
+	
+	unsigned char src_net[4];
+	unsigned char src_node[6];
+	uint16_t src_socket;
+	
+	uint16_t size;
+	char data[1];
+} __attribute__((__packed__));
+
+/* Size of the header in front of the payload of an ipx_packet. */
+#define IPX_PACKET_HEADER_SIZE (sizeof(ipx_packet) - 1)
+
+void ipx_packet_header_pack(ipx_packet *header,
+	uint8_t type,
+	addr32_t src_net,  addr48_t src_node,  uint16_t src_socket,
+	addr32_t dst_net, addr48_t dst_node, uint16_t dst_socket,
+	size_t payload_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !IPXWRAPPER_IPXPACKET_H */
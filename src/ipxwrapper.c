@@ -27,12 +27,14 @@
 #include <stdarg.h>
 #include <stdint.h>
 #include <time.h>
+#include <utlist.h>
 
 #include "ipxwrapper.h"
 #include "common.h"
 #include "interface.h"
 #include "router.h"
 #include "addrcache.h"
+#include "epoch.h"
 
 extern const char *version_string;
 extern const char *compile_time;
@@ -47,6 +49,45 @@ main_config_t main_config;
 
 static CRITICAL_SECTION sockets_cs;
 
+/* Secondary index over the sockets table, used to build the snapshot the
+ * router uses to find the sockets a packet may be delivered to.
+ * 
+ * Bound IPX sockets which haven't been shut down for receiving are filed in a
+ * bucket keyed by their IPX socket number, every other socket is filed in one
+ * of the lists below. Protected by sockets_cs like the table itself.
+*/
+
+struct ipx_socket_bucket {
+	uint16_t socket;
+	ipx_socket *sockets;
+	
+	UT_hash_handle hh;
+};
+
+typedef struct ipx_socket_bucket ipx_socket_bucket;
+
+static ipx_socket_bucket *bound_sockets = NULL;
+
+static ipx_socket *spx_sockets      = NULL;
+static ipx_socket *unbound_sockets  = NULL;
+static ipx_socket *shutdown_sockets = NULL;
+
+/* Current snapshot of the sockets table, see _publish_socket_snapshot(). */
+static ipx_socket_snapshot *volatile socket_snapshot = NULL;
+
+/* Number of sockets in the table falling in each slot of the filter, keyed by
+ * SOCKET_FILTER_SLOT(). Only modified with sockets_cs held, but read without
+ * it by get_socket() so calls on sockets which aren't ours can be passed
+ * straight through without taking the lock.
+*/
+#define SOCKET_FILTER_SIZE 4096
+#define SOCKET_FILTER_SLOT(fd) (((fd) >> 2) & (SOCKET_FILTER_SIZE - 1))
+
+static volatile LONG socket_filter[SOCKET_FILTER_SIZE];
+
+/* TLS slot holding each thread's packet encode buffer, see get_send_buf(). */
+static DWORD send_buf_tls = TLS_OUT_OF_INDEXES;
+
 typedef ULONGLONG WINAPI (*GetTickCount64_t)(void);
 static HMODULE kernel32 = NULL;
 
@@ -59,6 +100,30 @@ static void init_cs(CRITICAL_SECTION *cs)
 	}
 }
 
+/* Free the calling thread's packet encode buffer, if it has one. */
+static void _free_send_buf(void)
+{
+	if(send_buf_tls == TLS_OUT_OF_INDEXES)
+	{
+		return;
+	}
+	
+	free(TlsGetValue(send_buf_tls));
+	TlsSetValue(send_buf_tls, NULL);
+}
+
+/* Only restore cached addresses which are still reachable through the
+ * interface they were seen on.
+*/
+static bool addr_cache_entry_valid(addr32_t net, addr48_t node, const struct sockaddr_in *addr, addr32_t iface_net, addr48_t iface_node)
+{
+	addr32_t subnet_net;
+	addr48_t subnet_node;
+	
+	return ipx_interface_is_local_ip(addr->sin_addr.s_addr)
+		|| ipx_interface_has_subnet(addr->sin_addr.s_addr, false, iface_net, iface_node, &subnet_net, &subnet_node);
+}
+
 BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
 {
 	if(fdwReason == DLL_PROCESS_ATTACH)
@@ -90,11 +155,30 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
 		}
 		
 		addr_cache_init();
+		addr_cache_set_ttl(main_config.addr_cache_ttl);
+		
+		if(main_config.shared_addr_cache)
+		{
+			addr_cache_init_shared();
+		}
 		
 		ipx_interfaces_init();
 		
+		if(main_config.persist_addr_cache)
+		{
+			addr_cache_load(ADDR_CACHE_FILE, &addr_cache_entry_valid);
+		}
+		
 		init_cs(&sockets_cs);
 		
+		epoch_init();
+		
+		if((send_buf_tls = TlsAlloc()) == TLS_OUT_OF_INDEXES)
+		{
+			log_printf(LOG_ERROR, "Failed to allocate TLS index: %s", w32_error(GetLastError()));
+			return FALSE;
+		}
+		
 		WSADATA wsdata;
 		int err = WSAStartup(MAKEWORD(1,1), &wsdata);
 		if(err)
@@ -121,10 +205,25 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
 		
 		WSACleanup();
 		
+		free(socket_snapshot);
+		socket_snapshot = NULL;
+		
+		epoch_cleanup();
+		
+		_free_send_buf();
+		
+		TlsFree(send_buf_tls);
+		send_buf_tls = TLS_OUT_OF_INDEXES;
+		
 		DeleteCriticalSection(&sockets_cs);
 		
 		ipx_interfaces_cleanup();
 		
+		if(main_config.persist_addr_cache)
+		{
+			addr_cache_save(ADDR_CACHE_FILE);
+		}
+		
 		addr_cache_cleanup();
 		
 		unload_dlls();
@@ -137,10 +236,36 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
 			kernel32 = NULL;
 		}
 	}
+	else if(fdwReason == DLL_THREAD_DETACH)
+	{
+		epoch_thread_exit();
+		_free_send_buf();
+	}
 	
 	return TRUE;
 }
 
+/* Returns the calling thread's packet encode buffer, which is MAX_PKT_SIZE
+ * bytes long and large enough for any IPX packet or Ethernet frame we send.
+ * 
+ * The buffer is allocated the first time a thread sends and is kept until the
+ * thread exits, so sending doesn't need to go through the heap each time. The
+ * contents only remain valid until the thread next calls get_send_buf().
+ * 
+ * Returns NULL on malloc failure.
+*/
+void *get_send_buf(void)
+{
+	void *buf = TlsGetValue(send_buf_tls);
+	
+	if(!buf && (buf = malloc(MAX_PKT_SIZE)))
+	{
+		TlsSetValue(send_buf_tls, buf);
+	}
+	
+	return buf;
+}
+
 /* Lock the sockets table and search for one by file descriptor.
  * 
  * Returns an ipx_socket pointer on success, unlocks the sockets table and
@@ -148,6 +273,19 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
 */
 ipx_socket *get_socket(SOCKET sockfd)
 {
+	/* SOCKET values are multiples of 4, so the low bits are dropped when
+	 * picking a slot. If no socket in the table falls in the slot, this
+	 * can't be one of ours and the lock isn't needed.
+	 * 
+	 * A socket is counted before socket() or accept() returns it, so any
+	 * thread which has been given the SOCKET will see it counted.
+	*/
+	
+	if(socket_filter[SOCKET_FILTER_SLOT(sockfd)] == 0)
+	{
+		return NULL;
+	}
+	
 	lock_sockets();
 	
 	ipx_socket *sock;
@@ -161,6 +299,246 @@ ipx_socket *get_socket(SOCKET sockfd)
 	return sock;
 }
 
+/* Remove a socket from whichever index list it is currently filed in,
+ * releasing its bucket if it was the last socket in it.
+*/
+static void _unlink_socket_index(ipx_socket *sock)
+{
+	if(sock->index_list)
+	{
+		DL_DELETE2(*(sock->index_list), sock, index_prev, index_next);
+		sock->index_list = NULL;
+	}
+	
+	if(sock->index_bucket && !(sock->index_bucket->sockets))
+	{
+		HASH_DEL(bound_sockets, sock->index_bucket);
+		free(sock->index_bucket);
+	}
+	
+	sock->index_bucket = NULL;
+}
+
+static void _copy_socket_view(ipx_socket_view *view, const ipx_socket *sock)
+{
+	view->fd          = sock->fd;
+	view->port        = sock->port;
+	view->flags       = sock->flags;
+	view->f_ptype     = sock->f_ptype;
+	view->addr        = sock->addr;
+	view->remote_addr = sock->remote_addr;
+	view->stats       = sock->stats;
+	view->ring        = sock->ring;
+}
+
+static int _socket_view_cmp(const void *a, const void *b)
+{
+	return (int)(((const ipx_socket_view*)(a))->addr.sa_socket)
+		- (int)(((const ipx_socket_view*)(b))->addr.sa_socket);
+}
+
+/* Build a new snapshot of the delivery index and publish it for the router,
+ * retiring the previous one. Must be called with the sockets table locked.
+*/
+static void _publish_socket_snapshot(void)
+{
+	size_t n_recv = 0, n_spx = 0;
+	
+	ipx_socket_bucket *bucket, *tmp;
+	ipx_socket *sock;
+	
+	HASH_ITER(hh, bound_sockets, bucket, tmp)
+	{
+		DL_FOREACH2(bucket->sockets, sock, index_next)
+		{
+			++n_recv;
+		}
+	}
+	
+	DL_FOREACH2(spx_sockets, sock, index_next)
+	{
+		if(sock->flags & IPX_LISTENING)
+		{
+			++n_spx;
+		}
+	}
+	
+	ipx_socket_snapshot *snapshot = malloc(sizeof(ipx_socket_snapshot) + (n_recv + n_spx) * sizeof(ipx_socket_view));
+	if(!snapshot)
+	{
+		log_printf(LOG_ERROR, "Cannot allocate memory for socket snapshot!");
+		log_printf(LOG_WARNING, "Packets may be delivered using stale socket state");
+		
+		return;
+	}
+	
+	ipx_socket_view *view = snapshot->views;
+	
+	HASH_ITER(hh, bound_sockets, bucket, tmp)
+	{
+		DL_FOREACH2(bucket->sockets, sock, index_next)
+		{
+			_copy_socket_view(view++, sock);
+		}
+	}
+	
+	DL_FOREACH2(spx_sockets, sock, index_next)
+	{
+		if(sock->flags & IPX_LISTENING)
+		{
+			_copy_socket_view(view++, sock);
+		}
+	}
+	
+	qsort(snapshot->views, n_recv, sizeof(ipx_socket_view), &_socket_view_cmp);
+	
+	snapshot->recv_sockets    = snapshot->views;
+	snapshot->n_recv_sockets  = n_recv;
+	snapshot->spx_listeners   = snapshot->views + n_recv;
+	snapshot->n_spx_listeners = n_spx;
+	
+	ipx_socket_snapshot *old = InterlockedExchangePointer((void*volatile*)(&socket_snapshot), snapshot);
+	
+	router_update_sockets(snapshot);
+	
+	if(old)
+	{
+		epoch_retire(old, &free);
+	}
+}
+
+/* (Re)file a socket in the delivery index according to its current flags and
+ * address and republish the socket snapshot. Must be called with the sockets
+ * table locked whenever a socket is added to the table or any of its state
+ * copied into ipx_socket_view changes.
+*/
+void update_socket_index(ipx_socket *sock)
+{
+	_unlink_socket_index(sock);
+	
+	if(sock->flags & IPX_IS_SPX)
+	{
+		sock->index_list = &spx_sockets;
+	}
+	else if(!(sock->flags & IPX_BOUND))
+	{
+		sock->index_list = &unbound_sockets;
+	}
+	else if(!(sock->flags & IPX_RECV))
+	{
+		sock->index_list = &shutdown_sockets;
+	}
+	else{
+		ipx_socket_bucket *bucket;
+		HASH_FIND(hh, bound_sockets, &(sock->addr.sa_socket), sizeof(bucket->socket), bucket);
+		
+		if(!bucket)
+		{
+			if(!(bucket = malloc(sizeof(ipx_socket_bucket))))
+			{
+				log_printf(LOG_ERROR, "Cannot allocate memory for socket index!");
+				log_printf(LOG_WARNING, "Socket %d will not receive any packets", sock->fd);
+				
+				_publish_socket_snapshot();
+				return;
+			}
+			
+			bucket->socket  = sock->addr.sa_socket;
+			bucket->sockets = NULL;
+			
+			HASH_ADD(hh, bound_sockets, socket, sizeof(bucket->socket), bucket);
+		}
+		
+		sock->index_bucket = bucket;
+		sock->index_list   = &(bucket->sockets);
+	}
+	
+	DL_APPEND2(*(sock->index_list), sock, index_prev, index_next);
+	
+	_publish_socket_snapshot();
+}
+
+/* Remove a socket from the delivery index. Must be called with the sockets
+ * table locked before the socket is removed from the table.
+*/
+void remove_socket_index(ipx_socket *sock)
+{
+	_unlink_socket_index(sock);
+	_publish_socket_snapshot();
+}
+
+/* Add a new socket to the sockets table and the delivery index. Must be
+ * called with the sockets table locked.
+*/
+void add_socket(ipx_socket *sock)
+{
+	HASH_ADD_INT(sockets, fd, sock);
+	InterlockedIncrement(&(socket_filter[SOCKET_FILTER_SLOT(sock->fd)]));
+	
+	update_socket_index(sock);
+}
+
+/* Remove a socket from the sockets table and the delivery index. Must be
+ * called with the sockets table locked.
+*/
+void remove_socket(ipx_socket *sock)
+{
+	remove_socket_index(sock);
+	
+	InterlockedDecrement(&(socket_filter[SOCKET_FILTER_SLOT(sock->fd)]));
+	HASH_DEL(sockets, sock);
+}
+
+/* Returns the current socket snapshot, NULL if no sockets have been created.
+ * 
+ * Must be called from within an epoch read section, the snapshot may be freed
+ * once the section ends.
+*/
+const ipx_socket_snapshot *get_socket_snapshot(void)
+{
+	return socket_snapshot;
+}
+
+/* Find the sockets in a snapshot which may receive packets addressed to the
+ * given socket number (network byte order).
+ * 
+ * Returns a pointer to the first one and sets *count to the number of them.
+*/
+const ipx_socket_view *find_snapshot_sockets(const ipx_socket_snapshot *snapshot, uint16_t socknum, size_t *count)
+{
+	*count = 0;
+	
+	if(!snapshot)
+	{
+		return NULL;
+	}
+	
+	/* Binary search for the first socket bound to socknum. */
+	
+	size_t begin = 0, end = snapshot->n_recv_sockets;
+	
+	while(begin < end)
+	{
+		size_t mid = begin + (end - begin) / 2;
+		
+		if(snapshot->recv_sockets[mid].addr.sa_socket < socknum)
+		{
+			begin = mid + 1;
+		}
+		else{
+			end = mid;
+		}
+	}
+	
+	while((begin + *count) < snapshot->n_recv_sockets
+		&& snapshot->recv_sockets[begin + *count].addr.sa_socket == socknum)
+	{
+		++(*count);
+	}
+	
+	return snapshot->recv_sockets + begin;
+}
+
 /* Lock the mutex */
 void lock_sockets(void)
 {
@@ -27,15 +27,30 @@
 #include <uthash.h>
 
 #include "config.h"
+#include "ipxpacket.h"
 #include "router.h"
+#include "pktring.h"
 
 /* The standard Windows driver (in XP) only allows 1467 bytes anyway */
 #define MAX_DATA_SIZE 8192
 #define MAX_PKT_SIZE 8219
 
+/* Size of the ring used for each IPX socket when ring_delivery is enabled, and
+ * the size of the doorbell datagram sent to the socket for each packet.
+*/
+#define IPX_RING_SIZE     (256 * 1024)
+#define IPX_DOORBELL_SIZE 1
+
 #define IPX_CONNECT_TIMEOUT 6
 #define IPX_CONNECT_TRIES   3
 
+/* Address cache snapshot written when persist_addr_cache is set. */
+#define ADDR_CACHE_FILE "ipxwrapper-addrcache.dat"
+
+/* Broadcast network and node numbers. */
+#define BCAST_NET  addr32_in((unsigned char[]){0xFF,0xFF,0xFF,0xFF})
+#define BCAST_NODE addr48_in((unsigned char[]){0xFF,0xFF,0xFF,0xFF,0xFF,0xFF})
+
 #define IPX_FILTER	(int)(1<<0)
 #define IPX_BOUND	(int)(1<<1)
 #define IPX_BROADCAST	(int)(1<<2)
@@ -51,7 +66,6 @@
 #define IPX_CONNECT_OK	(int)(1<<13)
 
 typedef struct ipx_socket ipx_socket;
-typedef struct ipx_packet ipx_packet;
 
 struct ipx_socket {
 	SOCKET fd;
@@ -72,25 +86,69 @@ struct ipx_socket {
 	/* Address used with connect call, only set when IPX_CONNECTED is */
 	struct sockaddr_ipx remote_addr;
 	
+	/* Router statistics, NULL for SPX sockets. */
+	struct ipx_socket_stats *stats;
+	
+	/* Ring packets are delivered through, NULL if they are relayed over
+	 * loopback instead.
+	*/
+	pkt_ring_t *ring;
+	
+	/* Linkage into the delivery index, see update_socket_index(). */
+	ipx_socket **index_list;
+	struct ipx_socket_bucket *index_bucket;
+	
+	ipx_socket *index_prev;
+	ipx_socket *index_next;
+	
 	UT_hash_handle hh;
 };
 
-struct ipx_packet {
-	uint8_t ptype;
+/* Copy of the state the router needs to deliver packets to a socket, taken
+ * when the socket snapshot is published.
+*/
+
+typedef struct ipx_socket_view ipx_socket_view;
+
+struct ipx_socket_view {
+	SOCKET fd;
+	uint16_t port;
 	
-	unsigned char dest_net[4];
-	unsigned char dest_node[6];
-	uint16_t dest_socket;
+	int flags;
+	uint8_t f_ptype;
 	
-	unsigned char src_net[4];
-	unsigned char src_node[6];
-	uint16_t src_socket;
+	struct sockaddr_ipx addr;
+	struct sockaddr_ipx remote_addr;
 	
-	uint16_t size;
-	char data[1];
-} __attribute__((__packed__));
+	struct ipx_socket_stats *stats;
+	pkt_ring_t *ring;
+};
+
+/* Immutable snapshot of the sockets table, republished whenever it changes.
+ * Readers must only access it from within an epoch read section.
+*/
+
+typedef struct ipx_socket_snapshot ipx_socket_snapshot;
+
+struct ipx_socket_snapshot {
+	/* Bound IPX sockets which haven't been shut down for receiving,
+	 * sorted by socket number (network byte order).
+	*/
+	const ipx_socket_view *recv_sockets;
+	size_t n_recv_sockets;
+	
+	/* Listening SPX sockets. */
+	const ipx_socket_view *spx_listeners;
+	size_t n_spx_listeners;
+	
+	ipx_socket_view views[];
+};
 
-#define IPX_MAGIC_SPXLOOKUP 1
+#define IPX_MAGIC_SPXLOOKUP     1
+#define IPX_MAGIC_RELAY         2
+#define IPX_MAGIC_RESOLVE       3
+#define IPX_MAGIC_RESOLVE_REPLY 4
+#define IPX_MAGIC_ANNOUNCE      5
 
 typedef struct spxlookup_req spxlookup_req_t;
 
@@ -116,6 +174,57 @@ struct spxlookup_reply
 	char padding[18];
 }  __attribute__((__packed__));
 
+/* Payload of an IPX_MAGIC_RESOLVE packet, which is broadcast to find the IP
+ * address and port of the process which has an IPX socket bound to the given
+ * address. That process responds with an IPX_MAGIC_RESOLVE_REPLY packet with
+ * the same payload, sent from the address packets to it should be sent to.
+*/
+
+typedef struct resolve_msg resolve_msg_t;
+
+struct resolve_msg
+{
+	unsigned char net[4];
+	unsigned char node[6];
+	uint16_t socket;
+	
+	char padding[20];
+} __attribute__((__packed__));
+
+/* Payload of an IPX_MAGIC_ANNOUNCE packet, which is periodically broadcast by
+ * each process for each interface, with the interface address as the source.
+ * Lists the IPX sockets (network byte order) bound to the interface by the
+ * sending process, receivers cache the source address for the interface and
+ * each of the sockets.
+*/
+
+typedef struct announce_msg announce_msg_t;
+
+struct announce_msg
+{
+	uint16_t n_sockets;
+	uint16_t sockets[];
+} __attribute__((__packed__));
+
+#define ANNOUNCE_MAX_SOCKETS 512
+
+/* Header of an IPX_MAGIC_RELAY packet, which is sent by the shared router
+ * master to another process on the same host and followed by a packet which
+ * the master received from the given address.
+*/
+
+typedef struct relay_hdr relay_hdr_t;
+
+struct relay_hdr
+{
+	uint32_t src_ip;
+	uint16_t src_port;
+	
+	char padding[2];
+} __attribute__((__packed__));
+
+#define MAX_RELAY_PKT_SIZE (sizeof(ipx_packet) - 1 + sizeof(relay_hdr_t) + MAX_PKT_SIZE)
+
 typedef struct spxinit spxinit_t;
 
 struct spxinit
@@ -133,6 +242,14 @@ extern main_config_t main_config;
 ipx_socket *get_socket(SOCKET sockfd);
 void lock_sockets(void);
 void unlock_sockets(void);
+void *get_send_buf(void);
+
+void add_socket(ipx_socket *sock);
+void remove_socket(ipx_socket *sock);
+void update_socket_index(ipx_socket *sock);
+void remove_socket_index(ipx_socket *sock);
+const ipx_socket_snapshot *get_socket_snapshot(void);
+const ipx_socket_view *find_snapshot_sockets(const ipx_socket_snapshot *snapshot, uint16_t socknum, size_t *count);
 uint64_t get_ticks(void);
 
 void add_self_to_firewall(void);
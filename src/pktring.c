@@ -0,0 +1,229 @@
+/* IPXWrapper - Packet ring buffer
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* Ring buffer of variable length packets. Producers are serialised by a lock
+ * internal to pkt_ring_push(), which is only ever contended when packets are
+ * delivered from an application thread at the same time as the router thread.
+ * Consumers must hold the ring's lock while using pkt_ring_front() and
+ * pkt_ring_pop().
+ * 
+ * Each record is a 32-bit length followed by the packet, padded to a multiple
+ * of 4 bytes. A record never wraps around the end of the buffer, if there is
+ * not enough room left before the end, a RECORD_WRAP marker is written in
+ * place of the length and the record is written at the start.
+ * 
+ * At least RECORD_ALIGN bytes are always kept free so that a full ring can be
+ * told apart from an empty one.
+*/
+
+#include <windows.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pktring.h"
+#include "common.h"
+
+#define RECORD_ALIGN 4
+#define RECORD_WRAP  0xFFFFFFFF
+
+#define RECORD_SIZE(len) (sizeof(uint32_t) + (((len) + (RECORD_ALIGN - 1)) & ~(RECORD_ALIGN - 1)))
+
+struct pkt_ring
+{
+	/* Offset the next record will be written at, only modified by the
+	 * producer holding producer_cs.
+	*/
+	volatile size_t head;
+	
+	/* Offset of the oldest record, only modified by consumers. */
+	volatile size_t tail;
+	
+	size_t size;
+	
+	CRITICAL_SECTION producer_cs;
+	CRITICAL_SECTION consumer_cs;
+	
+	char buf[];
+};
+
+/* Allocate a new ring with a buffer of the given size, which will be rounded
+ * down to a multiple of 4 bytes. Returns NULL on failure.
+*/
+pkt_ring_t *pkt_ring_new(size_t size)
+{
+	size &= ~(RECORD_ALIGN - 1);
+	
+	pkt_ring_t *ring = malloc(sizeof(pkt_ring_t) + size);
+	if(!ring)
+	{
+		log_printf(LOG_ERROR, "Cannot allocate %u byte packet ring!", (unsigned int)(size));
+		return NULL;
+	}
+	
+	if(!InitializeCriticalSectionAndSpinCount(&(ring->producer_cs), 0x80000000))
+	{
+		log_printf(LOG_ERROR, "Failed to initialise critical section: %s", w32_error(GetLastError()));
+		
+		free(ring);
+		return NULL;
+	}
+	
+	if(!InitializeCriticalSectionAndSpinCount(&(ring->consumer_cs), 0x80000000))
+	{
+		log_printf(LOG_ERROR, "Failed to initialise critical section: %s", w32_error(GetLastError()));
+		
+		DeleteCriticalSection(&(ring->producer_cs));
+		free(ring);
+		return NULL;
+	}
+	
+	ring->head = 0;
+	ring->tail = 0;
+	ring->size = size;
+	
+	return ring;
+}
+
+void pkt_ring_free(pkt_ring_t *ring)
+{
+	if(ring)
+	{
+		DeleteCriticalSection(&(ring->consumer_cs));
+		DeleteCriticalSection(&(ring->producer_cs));
+		free(ring);
+	}
+}
+
+static bool _push(pkt_ring_t *ring, const void *hdr, size_t hdr_len, const void *data, size_t data_len)
+{
+	size_t len = hdr_len + data_len;
+	
+	size_t head = ring->head;
+	size_t tail = ring->tail;
+	
+	size_t used  = (head >= tail) ? (head - tail) : (ring->size - (tail - head));
+	size_t avail = ring->size - used - RECORD_ALIGN;
+	
+	size_t need = RECORD_SIZE(len);
+	size_t at   = head;
+	
+	if(head + need > ring->size)
+	{
+		/* Not enough room before the end of the buffer, the space up
+		 * to the end is lost to the wrap marker.
+		*/
+		
+		if((ring->size - head) + need > avail)
+		{
+			return false;
+		}
+		
+		*(uint32_t*)(ring->buf + head) = RECORD_WRAP;
+		at = 0;
+	}
+	else if(need > avail)
+	{
+		return false;
+	}
+	
+	*(uint32_t*)(ring->buf + at) = len;
+	memcpy(ring->buf + at + sizeof(uint32_t), hdr, hdr_len);
+	memcpy(ring->buf + at + sizeof(uint32_t) + hdr_len, data, data_len);
+	
+	/* Make sure the record is visible before the new head. */
+	
+	__sync_synchronize();
+	
+	ring->head = (at + need) % ring->size;
+	
+	return true;
+}
+
+/* Append a packet made up of a header and a payload to the ring as a single
+ * record. Returns false if there isn't room for it.
+*/
+bool pkt_ring_push(pkt_ring_t *ring, const void *hdr, size_t hdr_len, const void *data, size_t data_len)
+{
+	EnterCriticalSection(&(ring->producer_cs));
+	
+	bool ok = _push(ring, hdr, hdr_len, data, data_len);
+	
+	LeaveCriticalSection(&(ring->producer_cs));
+	
+	return ok;
+}
+
+void pkt_ring_lock(pkt_ring_t *ring)
+{
+	EnterCriticalSection(&(ring->consumer_cs));
+}
+
+void pkt_ring_unlock(pkt_ring_t *ring)
+{
+	LeaveCriticalSection(&(ring->consumer_cs));
+}
+
+/* Returns a pointer to the oldest packet in the ring and stores its length in
+ * *len, or returns NULL if the ring is empty. The packet remains in the ring
+ * until pkt_ring_pop() is called.
+ * 
+ * Must be called with the ring locked.
+*/
+const void *pkt_ring_front(pkt_ring_t *ring, size_t *len)
+{
+	size_t tail = ring->tail;
+	
+	if(tail == ring->head)
+	{
+		return NULL;
+	}
+	
+	/* Don't read the record until the head has been read. */
+	
+	__sync_synchronize();
+	
+	uint32_t rlen = *(uint32_t*)(ring->buf + tail);
+	
+	if(rlen == RECORD_WRAP)
+	{
+		/* The producer always writes the record following a wrap
+		 * marker before advancing the head past it.
+		*/
+		
+		ring->tail = tail = 0;
+		rlen = *(uint32_t*)(ring->buf);
+	}
+	
+	*len = rlen;
+	return ring->buf + tail + sizeof(uint32_t);
+}
+
+/* Remove the oldest packet from the ring. Must be called with the ring locked
+ * after a successful pkt_ring_front() call.
+*/
+void pkt_ring_pop(pkt_ring_t *ring)
+{
+	size_t tail = ring->tail;
+	uint32_t rlen = *(uint32_t*)(ring->buf + tail);
+	
+	/* Finish reading the record before the producer may reuse it. */
+	
+	__sync_synchronize();
+	
+	ring->tail = (tail + RECORD_SIZE(rlen)) % ring->size;
+}
@@ -0,0 +1,46 @@
+/* IPXWrapper - Packet ring buffer
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef IPXWRAPPER_PKTRING_H
+#define IPXWRAPPER_PKTRING_H
+
+#include <windows.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct pkt_ring pkt_ring_t;
+
+pkt_ring_t *pkt_ring_new(size_t size);
+void pkt_ring_free(pkt_ring_t *ring);
+
+bool pkt_ring_push(pkt_ring_t *ring, const void *hdr, size_t hdr_len, const void *data, size_t data_len);
+
+void pkt_ring_lock(pkt_ring_t *ring);
+void pkt_ring_unlock(pkt_ring_t *ring);
+
+const void *pkt_ring_front(pkt_ring_t *ring, size_t *len);
+void pkt_ring_pop(pkt_ring_t *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !IPXWRAPPER_PKTRING_H */
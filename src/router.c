@@ -21,6 +21,7 @@
 #include <windows.h>
 #include <uthash.h>
 #include <time.h>
+#include <inttypes.h>
 #include <pcap.h>
 #include <Win32-Extensions.h>
 
@@ -30,11 +31,14 @@
 #include "interface.h"
 #include "addrcache.h"
 #include "ethernet.h"
+#include "epoch.h"
 
 static bool router_running   = false;
 static WSAEVENT router_event = WSA_INVALID_EVENT;
 static HANDLE router_thread  = NULL;
 
+static enum main_config_router_engine router_engine = ROUTER_ENGINE_EVENT;
+
 /* The shared socket uses the UDP port number specified in the configuration,
  * every IPXWrapper instance will share it and use it to receive broadcast
  * packets.
@@ -51,7 +55,221 @@ static HANDLE router_thread  = NULL;
 SOCKET shared_socket  = -1;
 SOCKET private_socket = -1;
 
+/* Port the private socket is bound to (network byte order), used to recognise
+ * packets sent by this process when they are received back from the network.
+*/
+static uint16_t private_port = 0;
+
+/* IPX_MAGIC_RESOLVE requests which have been sent and not answered yet, an
+ * entry with a sent time of zero is unused. Once RESOLVE_TIMEOUT milliseconds
+ * have passed without a reply, router_resolve_begin() allows another request
+ * to be sent.
+*/
+
+#define RESOLVE_PENDING_MAX 32
+#define RESOLVE_TIMEOUT     500
+
+struct resolve_pending
+{
+	addr32_t net;
+	addr48_t node;
+	uint16_t socket;
+	
+	uint64_t sent;
+};
+
+static struct resolve_pending resolve_pending[RESOLVE_PENDING_MAX];
+static CRITICAL_SECTION resolve_cs;
+
+/* Time of the last IPX_MAGIC_ANNOUNCE broadcast, from get_ticks(). */
+static volatile uint64_t last_announce = 0;
+
+/* Seconds between snapshots of the address cache when persist_addr_cache is
+ * set. The snapshot is written by the router thread rather than when the DLL
+ * is detached, since DllMain() can't safely do anything when the process is
+ * exiting.
+*/
+#define ADDR_CACHE_SAVE_INTERVAL 10
+
+/* Time the address cache was last saved, from get_ticks(). Only used by the
+ * router thread.
+*/
+static uint64_t last_addr_cache_save = 0;
+
+static void _handle_udp_recv(ipx_packet *packet, size_t packet_size, struct sockaddr_in src_ip);
 static DWORD router_main(void *arg);
+static DWORD router_main_iocp(void *arg);
+
+/* Router statistics, see router.h. Counters are only ever modified using
+ * atomic operations. The per-interface entries are only added by the router
+ * thread, and n_ifaces is only incremented once an entry is initialised.
+*/
+
+static struct router_stats stats;
+
+#define STAT_ADD(counter, n) __sync_fetch_and_add(&(counter), (uint64_t)(n))
+#define STAT_GET(counter)    __sync_fetch_and_add(&(counter), 0)
+
+/* Count a packet dropped by a socket in both the process and socket totals. */
+#define SOCKET_DROP(sock, reason) \
+	do { \
+		STAT_ADD(stats.reason, 1); \
+		if((sock)->stats) \
+		{ \
+			STAT_ADD((sock)->stats->reason, 1); \
+		} \
+	} while(0)
+
+static void _iface_stats_add(addr32_t net, addr48_t node, size_t bytes)
+{
+	uint32_t i;
+	
+	for(i = 0; i < stats.n_ifaces; ++i)
+	{
+		if(addr32_in(stats.ifaces[i].net) == net && addr48_in(stats.ifaces[i].node) == node)
+		{
+			break;
+		}
+	}
+	
+	if(i == stats.n_ifaces)
+	{
+		if(i == ROUTER_MAX_IFACE_STATS)
+		{
+			return;
+		}
+		
+		addr32_out(stats.ifaces[i].net, net);
+		addr48_out(stats.ifaces[i].node, node);
+		
+		__sync_synchronize();
+		
+		++(stats.n_ifaces);
+	}
+	
+	STAT_ADD(stats.ifaces[i].rx_packets, 1);
+	STAT_ADD(stats.ifaces[i].rx_bytes, bytes);
+}
+
+/* Copy the router statistics. */
+void router_get_stats(struct router_stats *dest)
+{
+	#define COPY_COUNTER(name) dest->name = STAT_GET(stats.name);
+	ROUTER_STATS_COUNTERS(COPY_COUNTER)
+	
+	dest->n_ifaces = stats.n_ifaces;
+	__sync_synchronize();
+	
+	for(uint32_t i = 0; i < dest->n_ifaces; ++i)
+	{
+		memcpy(dest->ifaces[i].net, stats.ifaces[i].net, 4);
+		memcpy(dest->ifaces[i].node, stats.ifaces[i].node, 6);
+		
+		dest->ifaces[i].rx_packets = STAT_GET(stats.ifaces[i].rx_packets);
+		dest->ifaces[i].rx_bytes   = STAT_GET(stats.ifaces[i].rx_bytes);
+	}
+}
+
+/* Copy the statistics of a socket. */
+void router_get_socket_stats(struct ipx_socket_stats *dest, struct ipx_socket_stats *src)
+{
+	#define COPY_SOCKET_COUNTER(name) dest->name = STAT_GET(src->name);
+	SOCKET_STATS_COUNTERS(COPY_SOCKET_COUNTER)
+}
+
+static void _stats_log(void)
+{
+	log_printf(LOG_INFO, "Router statistics:");
+	
+	#define LOG_COUNTER(name) log_printf(LOG_INFO, "  %-20s %"PRIu64, #name, STAT_GET(stats.name));
+	ROUTER_STATS_COUNTERS(LOG_COUNTER)
+	
+	for(uint32_t i = 0; i < stats.n_ifaces; ++i)
+	{
+		IPX_STRING_ADDR(iface_addr, addr32_in(stats.ifaces[i].net), addr48_in(stats.ifaces[i].node), 0);
+		
+		log_printf(LOG_INFO, "  Interface %s: %"PRIu64" packets, %"PRIu64" bytes",
+			iface_addr, stats.ifaces[i].rx_packets, stats.ifaces[i].rx_bytes);
+	}
+	
+	struct addr_cache_stats cache_stats;
+	addr_cache_get_stats(&cache_stats);
+	
+	log_printf(LOG_INFO, "Address cache: %"PRIu64" entries, %"PRIu64" evicted, %"PRIu64" expired",
+		cache_stats.entries, cache_stats.evictions, cache_stats.expired);
+}
+
+/* State used by the IOCP router engine.
+ * 
+ * Each UDP socket has IOCP_RECVS_PER_SOCKET overlapped receives posted at all
+ * times, each with its own buffer from iocp_recvs. A completed receive is
+ * handled and then immediately posted again using the same buffer.
+*/
+
+#define IOCP_RECVS_PER_SOCKET 8
+
+struct iocp_recv
+{
+	OVERLAPPED overlapped;
+	
+	SOCKET sock;
+	WSABUF wsabuf;
+	
+	struct sockaddr_in addr;
+	int addrlen;
+	DWORD flags;
+	
+	char buf[MAX_PKT_SIZE];
+};
+
+static HANDLE router_iocp           = NULL;
+static struct iocp_recv *iocp_recvs = NULL;
+static unsigned int iocp_pending    = 0;
+
+/* Histogram of how many datagrams the router thread handled per wakeup.
+ * Bucket 0 counts wakeups with no datagrams, bucket n counts wakeups which
+ * handled between 2^(n-1) and (2^n)-1 datagrams, the last bucket counts any
+ * higher than that.
+ *
+ * Only written by the router thread, read by router_cleanup() once it exits.
+*/
+
+#define BATCH_HIST_BUCKETS 10
+
+static unsigned int batch_hist[BATCH_HIST_BUCKETS];
+
+static void _batch_hist_add(unsigned int n)
+{
+	unsigned int bucket = 0;
+	
+	while(n > 0 && bucket < (BATCH_HIST_BUCKETS - 1))
+	{
+		n >>= 1;
+		++bucket;
+	}
+	
+	++batch_hist[bucket];
+}
+
+static void _batch_hist_log(void)
+{
+	log_printf(LOG_DEBUG, "Router datagrams per wakeup:");
+	
+	for(unsigned int i = 0; i < BATCH_HIST_BUCKETS; ++i)
+	{
+		if(i == 0)
+		{
+			log_printf(LOG_DEBUG, "  0: %u", batch_hist[i]);
+		}
+		else if(i == (BATCH_HIST_BUCKETS - 1))
+		{
+			log_printf(LOG_DEBUG, "  %u+: %u", (1U << (i - 1)), batch_hist[i]);
+		}
+		else{
+			log_printf(LOG_DEBUG, "  %u-%u: %u", (1U << (i - 1)), (1U << i) - 1, batch_hist[i]);
+		}
+	}
+}
 
 /* Initialise a UDP socket. */
 static void _init_socket(SOCKET *sock, uint16_t port, BOOL reuseaddr)
@@ -90,241 +308,1181 @@ static void _init_socket(SOCKET *sock, uint16_t port, BOOL reuseaddr)
 		abort();
 	}
 	
-	if(WSAEventSelect(*sock, router_event, FD_READ) == -1)
+	if(router_engine == ROUTER_ENGINE_IOCP)
 	{
-		log_printf(LOG_ERROR, "WSAEventSelect error: %s", w32_error(WSAGetLastError()));
+		if(!CreateIoCompletionPort((HANDLE)(*sock), router_iocp, 0, 0))
+		{
+			log_printf(LOG_ERROR, "Error associating UDP socket with completion port: %s", w32_error(GetLastError()));
+			abort();
+		}
+	}
+	else{
+		if(WSAEventSelect(*sock, router_event, FD_READ) == -1)
+		{
+			log_printf(LOG_ERROR, "WSAEventSelect error: %s", w32_error(WSAGetLastError()));
+			abort();
+		}
+	}
+}
+
+/* Allocate the receive buffers for the IOCP engine, the receives themselves
+ * are posted by the router thread. Aborts on failure.
+*/
+static void _init_iocp_recvs(void)
+{
+	if(!(iocp_recvs = malloc(2 * IOCP_RECVS_PER_SOCKET * sizeof(struct iocp_recv))))
+	{
+		log_printf(LOG_ERROR, "Could not allocate memory!");
 		abort();
 	}
+	
+	for(unsigned int i = 0; i < IOCP_RECVS_PER_SOCKET; ++i)
+	{
+		iocp_recvs[i].sock                         = shared_socket;
+		iocp_recvs[i + IOCP_RECVS_PER_SOCKET].sock = private_socket;
+	}
 }
 
-/* Initialise the UDP socket and router worker thread.
- * Aborts on failure.
+/* State used when main_config.shared_router is enabled.
+ * 
+ * Every process using the same UDP port registers itself in a table held in a
+ * named shared memory section. Only one process at a time, the master, opens
+ * the shared socket. The master is elected by taking ownership of a named
+ * mutex, which its router thread holds until it exits. The router thread of
+ * every other process waits on the mutex, so if the master exits, or dies and
+ * abandons the mutex, another process takes over the shared socket.
+ * 
+ * The master relays broadcasts received on the shared socket to the private
+ * socket of each other process which has a socket bound to the destination
+ * socket number, wrapped in an IPX_MAGIC_RELAY packet carrying the original
+ * source address. Unicast packets are already sent straight to the private
+ * socket of the process they are for.
 */
-void router_init(void)
+
+#define ROUTER_SHM_PROCS 32
+
+/* Seconds between the master checking for processes which exited without
+ * removing themselves from the table.
+*/
+#define ROUTER_SHM_REAP_INTERVAL 5
+
+struct router_shm_proc
 {
-	/* Event object used for notification of new packets and exit signal. */
+	volatile LONG pid;
 	
-	if((router_event = WSACreateEvent()) == WSA_INVALID_EVENT)
+	/* Port the private socket of the process is bound to (network byte
+	 * order), zero until it is ready to receive relayed packets.
+	*/
+	volatile uint16_t port;
+	
+	/* Bitmap of socket numbers (host byte order) the process has sockets
+	 * bound to, only written by the process itself.
+	*/
+	volatile uint8_t sockets[65536 / 8];
+};
+
+struct router_shm
+{
+	volatile LONG master_pid;
+	
+	struct router_shm_proc procs[ROUTER_SHM_PROCS];
+};
+
+static HANDLE router_mutex   = NULL;
+static HANDLE router_shm_map = NULL;
+
+static struct router_shm *router_shm           = NULL;
+static struct router_shm_proc *router_shm_self = NULL;
+
+/* Only accessed by the router thread. */
+static bool router_master = false;
+
+static bool _process_running(DWORD pid)
+{
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, pid);
+	if(!process)
 	{
-		log_printf(LOG_ERROR, "Error creating WSA event object: %s", w32_error(WSAGetLastError()));
-		abort();
+		/* Access denied means the process exists. */
+		return GetLastError() != ERROR_INVALID_PARAMETER;
 	}
 	
-	if(ipx_use_pcap)
+	bool running = (WaitForSingleObject(process, 0) == WAIT_TIMEOUT);
+	
+	CloseHandle(process);
+	
+	return running;
+}
+
+/* Claim a free slot in the shared process table, taking over any slots left
+ * behind by processes which no longer exist.
+*/
+static struct router_shm_proc *_claim_shm_slot(void)
+{
+	LONG pid = GetCurrentProcessId();
+	
+	for(int i = 0; i < ROUTER_SHM_PROCS; ++i)
 	{
-		if((private_socket = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+		struct router_shm_proc *proc = &(router_shm->procs[i]);
+		LONG old_pid = proc->pid;
+		
+		if(old_pid != 0 && _process_running(old_pid))
 		{
-			log_printf(LOG_ERROR, "Error creating retransmit socket: %s", w32_error(WSAGetLastError()));
-			abort();
+			continue;
 		}
 		
-		struct sockaddr_in addr;
-		addr.sin_family      = AF_INET;
-		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-		addr.sin_port        = htons(0);
-		
-		if(bind(private_socket, (struct sockaddr*)(&addr), sizeof(addr)) == -1)
+		if(InterlockedCompareExchange(&(proc->pid), pid, old_pid) == old_pid)
 		{
-			log_printf(LOG_ERROR, "Error binding retransmit socket: %s", w32_error(WSAGetLastError()));
-			abort();
+			proc->port = 0;
+			memset((void*)(proc->sockets), 0, sizeof(proc->sockets));
+			
+			return proc;
 		}
 	}
-	else{
-		_init_socket(&shared_socket, main_config.udp_port, TRUE);
-		_init_socket(&private_socket, 0, FALSE);
-	}
-	
-	router_running = true;
 	
-	if(!(router_thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)(&router_main), NULL, 0, NULL)))
+	return NULL;
+}
+
+/* Remove any processes which exited without cleaning up from the table. */
+static void _reap_shm_slots(void)
+{
+	for(int i = 0; i < ROUTER_SHM_PROCS; ++i)
 	{
-		log_printf(LOG_ERROR, "Cannot create router worker thread: %s", w32_error(GetLastError()));
-		abort();
+		struct router_shm_proc *proc = &(router_shm->procs[i]);
+		LONG pid = proc->pid;
+		
+		if(pid != 0 && !_process_running(pid))
+		{
+			log_printf(LOG_DEBUG, "Removing exited process %u from shared router table", (unsigned int)(pid));
+			
+			proc->port = 0;
+			InterlockedCompareExchange(&(proc->pid), 0, pid);
+		}
 	}
 }
 
-void router_cleanup(void)
+/* Open (or create) the named mutex and shared memory used by the shared router
+ * and register this process. Returns false if the shared router can't be used.
+*/
+static bool _shared_router_init(void)
 {
-	/* Signal the router thread to exit. */
+	char name[64];
 	
-	router_running = false;
-	SetEvent(router_event);
+	snprintf(name, sizeof(name), "ipxwrapper_router_%hu", main_config.udp_port);
 	
-	/* Wait for it to exit, kill if it takes too long. */
+	if(!(router_mutex = CreateMutex(NULL, FALSE, name)))
+	{
+		log_printf(LOG_ERROR, "Error creating mutex %s: %s", name, w32_error(GetLastError()));
+		return false;
+	}
 	
-	if(WaitForSingleObject(router_thread, 3000) == WAIT_TIMEOUT)
+	snprintf(name, sizeof(name), "ipxwrapper_router_shm_%hu", main_config.udp_port);
+	
+	if(!(router_shm_map = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(struct router_shm), name)))
 	{
-		log_printf(LOG_WARNING, "Router thread didn't exit in 3 seconds, killing");
-		TerminateThread(router_thread, 0);
+		log_printf(LOG_ERROR, "Error creating file mapping %s: %s", name, w32_error(GetLastError()));
+		
+		CloseHandle(router_mutex);
+		router_mutex = NULL;
+		
+		return false;
 	}
 	
-	CloseHandle(router_thread);
-	router_thread = NULL;
+	if(!(router_shm = MapViewOfFile(router_shm_map, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(struct router_shm))))
+	{
+		log_printf(LOG_ERROR, "Error mapping %s: %s", name, w32_error(GetLastError()));
+		
+		CloseHandle(router_shm_map);
+		router_shm_map = NULL;
+		
+		CloseHandle(router_mutex);
+		router_mutex = NULL;
+		
+		return false;
+	}
 	
-	/* Release resources. */
+	if(!(router_shm_self = _claim_shm_slot()))
+	{
+		log_printf(LOG_WARNING, "Shared router table is full, this process will use its own router");
+		
+		UnmapViewOfFile(router_shm);
+		router_shm = NULL;
+		
+		CloseHandle(router_shm_map);
+		router_shm_map = NULL;
+		
+		CloseHandle(router_mutex);
+		router_mutex = NULL;
+		
+		return false;
+	}
 	
-	if(private_socket != -1)
+	return true;
+}
+
+static void _shared_router_cleanup(void)
+{
+	if(router_shm_self)
 	{
-		closesocket(private_socket);
-		private_socket = -1;
+		router_shm_self->port = 0;
+		
+		__sync_synchronize();
+		
+		router_shm_self->pid = 0;
+		router_shm_self      = NULL;
 	}
 	
-	if(shared_socket != -1)
+	if(router_shm)
 	{
-		closesocket(shared_socket);
-		shared_socket = -1;
+		UnmapViewOfFile(router_shm);
+		router_shm = NULL;
 	}
 	
-	if(router_event != WSA_INVALID_EVENT)
+	if(router_shm_map)
 	{
-		WSACloseEvent(router_event);
-		router_event = WSA_INVALID_EVENT;
+		CloseHandle(router_shm_map);
+		router_shm_map = NULL;
+	}
+	
+	if(router_mutex)
+	{
+		CloseHandle(router_mutex);
+		router_mutex = NULL;
 	}
 }
 
-#define BCAST_NET  addr32_in((unsigned char[]){0xFF,0xFF,0xFF,0xFF})
-#define BCAST_NODE addr48_in((unsigned char[]){0xFF,0xFF,0xFF,0xFF,0xFF,0xFF})
-#define ZERO_NET   addr32_in((unsigned char[]){0x00,0x00,0x00,0x00})
-
-static void _deliver_packet(
-	uint8_t type,
-	addr32_t src_net,
-	addr48_t src_node,
-	uint16_t src_socket,
-	addr32_t dest_net,
-	addr48_t dest_node,
-	uint16_t dest_socket,
-	const void *data,
-	size_t data_size)
+/* Update the socket numbers this process is advertising to the shared router
+ * master. Called with the sockets table locked whenever the socket snapshot
+ * is republished.
+*/
+void router_update_sockets(const struct ipx_socket_snapshot *snapshot)
 {
+	if(!router_shm_self)
 	{
-		IPX_STRING_ADDR(src_addr, src_net, src_node, src_socket);
-		IPX_STRING_ADDR(dest_addr, dest_net, dest_node, dest_socket);
-		
-		log_printf(LOG_DEBUG, "Delivering %u byte payload from %s to %s",
-			(unsigned int)(data_size), src_addr, dest_addr);
+		return;
 	}
 	
-	lock_sockets();
+	static uint8_t sockets[65536 / 8];
+	memset(sockets, 0, sizeof(sockets));
 	
-	ipx_socket *sock, *tmp;
-	HASH_ITER(hh, sockets, sock, tmp)
+	for(size_t i = 0; i < snapshot->n_recv_sockets; ++i)
 	{
-		if(sock->flags & IPX_IS_SPX)
-		{
-			/* Socket is SPX */
-			continue;
-		}
-		
-		if(!(sock->flags & IPX_BOUND))
-		{
-			/* Socket isn't bound */
-			continue;
-		}
-		
-		if(!(sock->flags & IPX_RECV))
+		uint16_t socknum = ntohs(snapshot->recv_sockets[i].addr.sa_socket);
+		sockets[socknum / 8] |= (1 << (socknum % 8));
+	}
+	
+	for(size_t i = 0; i < sizeof(sockets); ++i)
+	{
+		if(router_shm_self->sockets[i] != sockets[i])
 		{
-			/* Socket is shut down for receive operations. */
-			continue;
+			router_shm_self->sockets[i] = sockets[i];
 		}
-		
-		if((sock->flags & IPX_FILTER) && sock->f_ptype != type)
-		{
+	}
+}
+
+/* Send a datagram made up of a header and a payload to a loopback port without
+ * copying them together first.
+ * 
+ * Returns zero on success, -1 on failure.
+*/
+static int _relay_sendv(uint16_t port, const void *hdr, size_t hdr_len, const void *data, size_t data_len)
+{
+	struct sockaddr_in send_addr;
+	
+	send_addr.sin_family      = AF_INET;
+	send_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	send_addr.sin_port        = port;
+	
+	WSABUF bufs[2] = {
+		{ .len = hdr_len,  .buf = (char*)(hdr) },
+		{ .len = data_len, .buf = (char*)(data) },
+	};
+	
+	DWORD sent;
+	
+	return WSASendTo(private_socket, bufs, 2, &sent, 0, (struct sockaddr*)(&send_addr), sizeof(send_addr), NULL, NULL);
+}
+
+/* Relay a datagram received on the shared socket to any other processes which
+ * have a socket bound to its destination socket number. Magic packets are
+ * relayed to every process.
+*/
+static void _relay_to_procs(const char *buf, size_t len, struct sockaddr_in src_ip)
+{
+	if(len < sizeof(ipx_packet) - 1 || len > MAX_PKT_SIZE)
+	{
+		return;
+	}
+	
+	const ipx_packet *packet = (const ipx_packet*)(buf);
+	
+	bool magic = (packet->src_socket == 0);
+	uint16_t socknum = ntohs(packet->dest_socket);
+	
+	/* The datagram is sent on after an IPX_MAGIC_RELAY header and a
+	 * relay_hdr_t, which are only built once a process to relay it to has
+	 * been found.
+	*/
+	
+	struct {
+		char packet[IPX_PACKET_HEADER_SIZE];
+		relay_hdr_t hdr;
+	} __attribute__((__packed__)) relay_buf;
+	
+	ipx_packet *relay = NULL;
+	
+	for(int i = 0; i < ROUTER_SHM_PROCS; ++i)
+	{
+		struct router_shm_proc *proc = &(router_shm->procs[i]);
+		
+		uint16_t port = proc->port;
+		
+		if(proc == router_shm_self || port == 0
+			|| !(magic || (proc->sockets[socknum / 8] & (1 << (socknum % 8)))))
+		{
+			continue;
+		}
+		
+		if(!relay)
+		{
+			relay = (ipx_packet*)(relay_buf.packet);
+			memset(&relay_buf, 0, sizeof(relay_buf));
+			
+			relay->ptype = IPX_MAGIC_RELAY;
+			relay->size  = htons(sizeof(relay_hdr_t) + len);
+			
+			relay_buf.hdr.src_ip   = src_ip.sin_addr.s_addr;
+			relay_buf.hdr.src_port = src_ip.sin_port;
+		}
+		
+		if(_relay_sendv(port, &relay_buf, sizeof(relay_buf), buf, len) == -1)
+		{
+			log_printf(LOG_ERROR, "Error relaying packet to process %u: %s",
+				(unsigned int)(proc->pid), w32_error(WSAGetLastError()));
+			
+			STAT_ADD(stats.drop_relay_error, 1);
+			continue;
+		}
+		
+		STAT_ADD(stats.shared_relayed_packets, 1);
+	}
+}
+
+/* Called by the router thread once it owns router_mutex. */
+static void _become_master(bool abandoned)
+{
+	if(abandoned)
+	{
+		log_printf(LOG_WARNING, "Previous shared router master exited uncleanly, taking over");
+	}
+	else{
+		log_printf(LOG_INFO, "This process is now the shared router master");
+	}
+	
+	_init_socket(&shared_socket, main_config.udp_port, TRUE);
+	
+	router_master = true;
+	router_shm->master_pid = GetCurrentProcessId();
+	
+	_reap_shm_slots();
+}
+
+/* Called by the router thread before it exits. The shared socket is closed
+ * before releasing the mutex so the next master isn't receiving packets at the
+ * same time.
+*/
+static void _release_master(void)
+{
+	if(!router_master)
+	{
+		return;
+	}
+	
+	closesocket(shared_socket);
+	shared_socket = -1;
+	
+	router_shm->master_pid = 0;
+	router_master = false;
+	
+	ReleaseMutex(router_mutex);
+}
+
+/* Initialise the UDP socket and router worker thread.
+ * Aborts on failure.
+*/
+void router_init(void)
+{
+	if(!InitializeCriticalSectionAndSpinCount(&resolve_cs, 0x80000000))
+	{
+		log_printf(LOG_ERROR, "Failed to initialise critical section: %s", w32_error(GetLastError()));
+		abort();
+	}
+	
+	memset(resolve_pending, 0, sizeof(resolve_pending));
+	
+	/* Event object used for notification of new packets and exit signal. */
+	
+	if((router_event = WSACreateEvent()) == WSA_INVALID_EVENT)
+	{
+		log_printf(LOG_ERROR, "Error creating WSA event object: %s", w32_error(WSAGetLastError()));
+		abort();
+	}
+	
+	if(ipx_use_pcap)
+	{
+		if((private_socket = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+		{
+			log_printf(LOG_ERROR, "Error creating retransmit socket: %s", w32_error(WSAGetLastError()));
+			abort();
+		}
+		
+		struct sockaddr_in addr;
+		addr.sin_family      = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port        = htons(0);
+		
+		if(bind(private_socket, (struct sockaddr*)(&addr), sizeof(addr)) == -1)
+		{
+			log_printf(LOG_ERROR, "Error binding retransmit socket: %s", w32_error(WSAGetLastError()));
+			abort();
+		}
+	}
+	else{
+		router_engine = main_config.router_engine;
+		
+		bool shared = main_config.shared_router && _shared_router_init();
+		
+		if(shared && router_engine == ROUTER_ENGINE_IOCP)
+		{
+			log_printf(LOG_WARNING, "The IOCP router engine can't be used with shared_router, using the event engine");
+			router_engine = ROUTER_ENGINE_EVENT;
+		}
+		
+		if(router_engine == ROUTER_ENGINE_IOCP)
+		{
+			if(!(router_iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1)))
+			{
+				log_printf(LOG_ERROR, "Error creating I/O completion port: %s", w32_error(GetLastError()));
+				abort();
+			}
+		}
+		
+		/* When using the shared router, the shared socket is only
+		 * opened by the router thread of the master process.
+		*/
+		
+		if(!shared)
+		{
+			_init_socket(&shared_socket, main_config.udp_port, TRUE);
+		}
+		
+		_init_socket(&private_socket, 0, FALSE);
+		
+		struct sockaddr_in addr;
+		int addrlen = sizeof(addr);
+		
+		if(getsockname(private_socket, (struct sockaddr*)(&addr), &addrlen) == -1)
+		{
+			log_printf(LOG_ERROR, "Error getting private socket address: %s", w32_error(WSAGetLastError()));
+			abort();
+		}
+		
+		private_port = addr.sin_port;
+		
+		if(shared)
+		{
+			router_shm_self->port = private_port;
+		}
+		
+		if(router_engine == ROUTER_ENGINE_IOCP)
+		{
+			_init_iocp_recvs();
+		}
+	}
+	
+	router_running = true;
+	
+	LPTHREAD_START_ROUTINE main_func = (router_engine == ROUTER_ENGINE_IOCP)
+		? (LPTHREAD_START_ROUTINE)(&router_main_iocp)
+		: (LPTHREAD_START_ROUTINE)(&router_main);
+	
+	if(!(router_thread = CreateThread(NULL, 0, main_func, NULL, 0, NULL)))
+	{
+		log_printf(LOG_ERROR, "Cannot create router worker thread: %s", w32_error(GetLastError()));
+		abort();
+	}
+}
+
+void router_cleanup(void)
+{
+	/* Signal the router thread to exit. */
+	
+	router_running = false;
+	SetEvent(router_event);
+	
+	if(router_iocp)
+	{
+		PostQueuedCompletionStatus(router_iocp, 0, 0, NULL);
+	}
+	
+	/* Wait for it to exit, kill if it takes too long. */
+	
+	if(WaitForSingleObject(router_thread, 3000) == WAIT_TIMEOUT)
+	{
+		log_printf(LOG_WARNING, "Router thread didn't exit in 3 seconds, killing");
+		TerminateThread(router_thread, 0);
+	}
+	
+	CloseHandle(router_thread);
+	router_thread = NULL;
+	
+	_stats_log();
+	
+	if(router_engine == ROUTER_ENGINE_EVENT)
+	{
+		_batch_hist_log();
+	}
+	
+	/* Release resources. */
+	
+	if(private_socket != -1)
+	{
+		closesocket(private_socket);
+		private_socket = -1;
+	}
+	
+	if(shared_socket != -1)
+	{
+		closesocket(shared_socket);
+		shared_socket = -1;
+	}
+	
+	if(router_iocp)
+	{
+		CloseHandle(router_iocp);
+		router_iocp = NULL;
+	}
+	
+	_shared_router_cleanup();
+	
+	if(iocp_pending == 0)
+	{
+		free(iocp_recvs);
+	}
+	else{
+		/* The router thread was killed with receives still pending,
+		 * leak the buffers rather than let the kernel write to freed
+		 * memory.
+		*/
+		
+		log_printf(LOG_WARNING, "Leaking %u pending router receive buffers", iocp_pending);
+	}
+	
+	iocp_recvs = NULL;
+	
+	if(router_event != WSA_INVALID_EVENT)
+	{
+		WSACloseEvent(router_event);
+		router_event = WSA_INVALID_EVENT;
+	}
+	
+	DeleteCriticalSection(&resolve_cs);
+}
+
+static const char doorbell[IPX_DOORBELL_SIZE] = { 0 };
+
+#define ZERO_NET   addr32_in((unsigned char[]){0x00,0x00,0x00,0x00})
+
+/* Relay a packet to any local sockets which should receive it. Only the header
+ * is serialised, the payload is sent straight from data.
+ * 
+ * received is true for packets which came in through the router, which are
+ * counted as dropped if no socket wants them. Packets sent by this process
+ * usually aren't for a local socket, so they aren't.
+ * 
+ * Returns the number of sockets the packet was relayed to.
+*/
+static int _deliver_packet(
+	uint8_t type,
+	addr32_t src_net,
+	addr48_t src_node,
+	uint16_t src_socket,
+	addr32_t dest_net,
+	addr48_t dest_node,
+	uint16_t dest_socket,
+	const void *data,
+	size_t data_size,
+	bool received)
+{
+	{
+		IPX_STRING_ADDR(src_addr, src_net, src_node, src_socket);
+		IPX_STRING_ADDR(dest_addr, dest_net, dest_node, dest_socket);
+		
+		log_printf(LOG_DEBUG, "Delivering %u byte payload from %s to %s",
+			(unsigned int)(data_size), src_addr, dest_addr);
+	}
+	
+	if(IPX_PACKET_HEADER_SIZE + data_size > MAX_PKT_SIZE)
+	{
+		log_printf(LOG_ERROR, "Tried relaying a %u byte payload, too large to relay",
+			(unsigned int)(data_size));
+		
+		STAT_ADD(stats.drop_bad_size, 1);
+		return 0;
+	}
+	
+	/* The header is only serialised once a socket which should receive
+	 * the packet has been found.
+	*/
+	
+	char header_buf[IPX_PACKET_HEADER_SIZE];
+	ipx_packet *header = NULL;
+	
+	int relayed = 0;
+	
+	/* The socket snapshot is read without locking the sockets table, so
+	 * application threads are never blocked while packets are relayed.
+	 * 
+	 * Only bound IPX sockets which haven't been shut down for receiving are
+	 * in the snapshot, sorted by socket number, so the only sockets which
+	 * need checking are those bound to the destination socket.
+	*/
+	
+	epoch_enter();
+	
+	size_t n_socks;
+	const ipx_socket_view *socks = find_snapshot_sockets(get_socket_snapshot(), dest_socket, &n_socks);
+	
+	for(size_t i = 0; i < n_socks; ++i)
+	{
+		const ipx_socket_view *sock = &(socks[i]);
+		
+		if((sock->flags & IPX_FILTER) && sock->f_ptype != type)
+		{
 			/* Socket has packet type filtering enabled and this
 			 * packet is of the wrong type.
 			*/
+			SOCKET_DROP(sock, drop_filter_ptype);
 			continue;
 		}
 		
-		if((dest_net != addr32_in(sock->addr.sa_netnum) && dest_net != BCAST_NET)
-			|| (dest_node != addr48_in(sock->addr.sa_nodenum) && dest_node != BCAST_NODE)
-			|| dest_socket != sock->addr.sa_socket)
-		{
-			/* Packet destination address is neither the local
-			 * address of this socket nor broadcast.
-			*/
-			continue;
-		}
+		if((dest_net != addr32_in(sock->addr.sa_netnum) && dest_net != BCAST_NET)
+			|| (dest_node != addr48_in(sock->addr.sa_nodenum) && dest_node != BCAST_NODE))
+		{
+			/* Packet destination address is neither the local
+			 * address of this socket nor broadcast.
+			*/
+			continue;
+		}
+		
+		if((dest_net == BCAST_NET || dest_node == BCAST_NODE)
+			&& !(sock->flags & IPX_RECV_BCAST))
+		{
+			/* Packet destination address includes a broadcast part
+			 * and this socket has explicitly disabled reception of
+			 * broadcasts.
+			*/
+			SOCKET_DROP(sock, drop_bcast_disabled);
+			continue;
+		}
+		
+		if((dest_net == BCAST_NET || dest_node == BCAST_NODE)
+			&& (main_config.w95_bug && !(sock->flags & IPX_BROADCAST)))
+		{
+			/* Packet destination address includes a broadcast part,
+			 * socket has not enabled the SO_BROADCAST option and
+			 * the Windows 95 SO_BROADCAST bug is being emulated.
+			*/
+			SOCKET_DROP(sock, drop_w95_bug);
+			continue;
+		}
+		
+		if((sock->flags & IPX_CONNECTED)
+			&& (src_net != addr32_in(sock->remote_addr.sa_netnum)
+			|| src_node != addr48_in(sock->remote_addr.sa_nodenum)
+			|| src_socket != sock->remote_addr.sa_socket))
+		{
+			/* Socket is "connected" and the source address isn't
+			 * the remote address of the socket.
+			*/
+			SOCKET_DROP(sock, drop_remote_addr);
+			continue;
+		}
+		
+		log_printf(LOG_DEBUG, "...relaying to local port %hu", ntohs(sock->port));
+		
+		if(!header)
+		{
+			/* First recipient of this packet, serialise the header.
+			 * Every other recipient is sent the same one.
+			*/
+			
+			header = (ipx_packet*)(header_buf);
+			
+			ipx_packet_header_pack(header,
+				type,
+				src_net,  src_node,  src_socket,
+				dest_net, dest_node, dest_socket,
+				data_size);
+			
+			STAT_ADD(stats.delivered_packets, 1);
+			STAT_ADD(stats.delivered_bytes, data_size);
+		}
+		
+		if(sock->ring)
+		{
+			/* The socket is using ring delivery, add the packet to
+			 * its ring and just send a doorbell datagram to wake up
+			 * the backing socket.
+			 * 
+			 * The doorbell is only a wakeup, so if it can't be sent
+			 * the packet stays in the ring and is read after the
+			 * next doorbell, see recv_packet().
+			*/
+			
+			if(!pkt_ring_push(sock->ring, header, IPX_PACKET_HEADER_SIZE, data, data_size))
+			{
+				log_printf(LOG_DEBUG, "...ring full, dropping");
+				
+				SOCKET_DROP(sock, drop_ring_full);
+				continue;
+			}
+			
+			if(_relay_sendv(sock->port, doorbell, sizeof(doorbell), NULL, 0) == -1)
+			{
+				log_printf(LOG_WARNING, "Error sending doorbell: %s", w32_error(WSAGetLastError()));
+			}
+		}
+		else if(_relay_sendv(sock->port, header, IPX_PACKET_HEADER_SIZE, data, data_size) == -1)
+		{
+			log_printf(LOG_ERROR, "Error relaying packet: %s", w32_error(WSAGetLastError()));
+			SOCKET_DROP(sock, drop_relay_error);
+			
+			continue;
+		}
+		
+		++relayed;
+		
+		STAT_ADD(stats.relayed_packets, 1);
+		STAT_ADD(stats.relayed_bytes, data_size);
+		
+		if(sock->stats)
+		{
+			STAT_ADD(sock->stats->relayed_packets, 1);
+			STAT_ADD(sock->stats->relayed_bytes, data_size);
+		}
+	}
+	
+	epoch_leave();
+	
+	if(!header && received)
+	{
+		STAT_ADD(stats.drop_no_recipient, 1);
+	}
+	
+	return relayed;
+}
+
+/* Deliver a packet sent by this process directly to any local sockets which
+ * should receive it, without it passing through the network and back into the
+ * router. Safe to call from any thread.
+ * 
+ * Returns the number of sockets the packet was relayed to.
+*/
+int router_deliver_local(
+	uint8_t type,
+	addr32_t src_net,
+	addr48_t src_node,
+	uint16_t src_socket,
+	addr32_t dest_net,
+	addr48_t dest_node,
+	uint16_t dest_socket,
+	const void *data,
+	size_t data_size)
+{
+	return _deliver_packet(
+		type,
+		src_net,  src_node,  src_socket,
+		dest_net, dest_node, dest_socket,
+		data, data_size, false);
+}
+
+/* Unwrap a packet relayed by the shared router master and handle it as if it
+ * had been received from the original sender.
+*/
+static void _handle_relayed(ipx_packet *packet, size_t packet_size, struct sockaddr_in src_ip)
+{
+	size_t data_size = ntohs(packet->size);
+	
+	if(src_ip.sin_addr.s_addr != htonl(INADDR_LOOPBACK) || !router_shm_self || router_master)
+	{
+		/* Only the master on this host relays packets, and never to
+		 * itself.
+		*/
+		
+		log_printf(LOG_DEBUG, "Recieved unexpected IPX_MAGIC_RELAY packet from %s, dropping", inet_ntoa(src_ip.sin_addr));
+		
+		STAT_ADD(stats.drop_bad_relay, 1);
+		return;
+	}
+	
+	if(data_size + sizeof(ipx_packet) - 1 != packet_size
+		|| data_size < sizeof(relay_hdr_t) + sizeof(ipx_packet) - 1)
+	{
+		log_printf(LOG_DEBUG, "Recieved IPX_MAGIC_RELAY packet with %u byte payload, dropping", (unsigned int)(data_size));
+		
+		STAT_ADD(stats.drop_bad_relay, 1);
+		return;
+	}
+	
+	relay_hdr_t *hdr = (relay_hdr_t*)(packet->data);
+	
+	ipx_packet *inner = (ipx_packet*)(packet->data + sizeof(relay_hdr_t));
+	size_t inner_size = data_size - sizeof(relay_hdr_t);
+	
+	if(inner->src_socket == 0 && inner->ptype == IPX_MAGIC_RELAY)
+	{
+		STAT_ADD(stats.drop_bad_relay, 1);
+		return;
+	}
+	
+	struct sockaddr_in orig_ip;
+	memset(&orig_ip, 0, sizeof(orig_ip));
+	
+	orig_ip.sin_family      = AF_INET;
+	orig_ip.sin_addr.s_addr = hdr->src_ip;
+	orig_ip.sin_port        = hdr->src_port;
+	
+	_handle_udp_recv(inner, inner_size, orig_ip);
+}
+
+/* Called by ipx_send_packet() when a unicast packet is sent to an address
+ * which isn't in the address cache. Returns true if an IPX_MAGIC_RESOLVE
+ * request should be broadcast for it, which is the case unless one was sent
+ * in the last RESOLVE_TIMEOUT milliseconds and hasn't been answered.
+*/
+bool router_resolve_begin(addr32_t net, addr48_t node, uint16_t socket)
+{
+	uint64_t now = get_ticks();
+	
+	EnterCriticalSection(&resolve_cs);
+	
+	/* Find the entry for the address, or the oldest one to replace. */
+	
+	struct resolve_pending *p = NULL;
+	
+	for(int i = 0; i < RESOLVE_PENDING_MAX; ++i)
+	{
+		struct resolve_pending *e = &(resolve_pending[i]);
+		
+		if(e->sent && e->net == net && e->node == node && e->socket == socket)
+		{
+			p = e;
+			break;
+		}
+		
+		if(!p || e->sent < p->sent)
+		{
+			p = e;
+		}
+	}
+	
+	bool send = !(p->sent && p->net == net && p->node == node && p->socket == socket
+		&& (now - p->sent) < RESOLVE_TIMEOUT);
+	
+	if(send)
+	{
+		p->net    = net;
+		p->node   = node;
+		p->socket = socket;
+		p->sent   = now;
+	}
+	
+	LeaveCriticalSection(&resolve_cs);
+	
+	return send;
+}
+
+/* Remove the pending request for an address, returns false if there wasn't
+ * one.
+*/
+static bool _resolve_end(addr32_t net, addr48_t node, uint16_t socket)
+{
+	bool found = false;
+	
+	EnterCriticalSection(&resolve_cs);
+	
+	for(int i = 0; i < RESOLVE_PENDING_MAX; ++i)
+	{
+		struct resolve_pending *e = &(resolve_pending[i]);
+		
+		if(e->sent && e->net == net && e->node == node && e->socket == socket)
+		{
+			e->sent = 0;
+			found   = true;
+			
+			break;
+		}
+	}
+	
+	LeaveCriticalSection(&resolve_cs);
+	
+	return found;
+}
+
+/* Answer an IPX_MAGIC_RESOLVE request if a socket in this process is bound to
+ * the requested address.
+*/
+static void _handle_resolve(const resolve_msg_t *req, struct sockaddr_in src_ip)
+{
+	bool bound = false;
+	
+	epoch_enter();
+	
+	const ipx_socket_snapshot *snapshot = get_socket_snapshot();
+	
+	size_t count = 0;
+	const ipx_socket_view *s = snapshot
+		? find_snapshot_sockets(snapshot, req->socket, &count)
+		: NULL;
+	
+	for(size_t i = 0; i < count; ++i)
+	{
+		if(memcmp(req->net, s[i].addr.sa_netnum, 4) == 0 && memcmp(req->node, s[i].addr.sa_nodenum, 6) == 0)
+		{
+			bound = true;
+			break;
+		}
+	}
+	
+	epoch_leave();
+	
+	if(!bound)
+	{
+		return;
+	}
+	
+	char buf[sizeof(ipx_packet) - 1 + sizeof(resolve_msg_t)];
+	memset(buf, 0, sizeof(buf));
+	
+	ipx_packet *reply = (ipx_packet*)(buf);
+	
+	reply->ptype = IPX_MAGIC_RESOLVE_REPLY;
+	
+	memcpy(reply->src_net, req->net, 4);
+	memcpy(reply->src_node, req->node, 6);
+	reply->src_socket = 0;
+	
+	reply->size = htons(sizeof(resolve_msg_t));
+	memcpy(reply->data, req, sizeof(resolve_msg_t));
+	
+	if(r_sendto(private_socket, buf, sizeof(buf), 0, (struct sockaddr*)(&src_ip), sizeof(src_ip)) == -1)
+	{
+		log_printf(LOG_ERROR, "Cannot send IPX_MAGIC_RESOLVE_REPLY packet: %s", w32_error(WSAGetLastError()));
+		return;
+	}
+	
+	STAT_ADD(stats.resolve_replies_sent, 1);
+}
+
+/* Cache the address of an IPX_MAGIC_RESOLVE_REPLY packet, if it answers one of
+ * our own requests.
+*/
+static void _handle_resolve_reply(const resolve_msg_t *reply, struct sockaddr_in src_ip)
+{
+	addr32_t net  = addr32_in(reply->net);
+	addr48_t node = addr48_in(reply->node);
+	
+	addr32_t iface_net;
+	addr48_t iface_node;
+	
+	if(!_resolve_end(net, node, reply->socket)
+		|| !ipx_interface_has_subnet(src_ip.sin_addr.s_addr, true, net, node, &iface_net, &iface_node))
+	{
+		log_printf(LOG_DEBUG, "Recieved unexpected IPX_MAGIC_RESOLVE_REPLY packet from %s, dropping", inet_ntoa(src_ip.sin_addr));
+		
+		STAT_ADD(stats.drop_bad_resolve, 1);
+		return;
+	}
+	
+	if(min_log_level <= LOG_DEBUG)
+	{
+		IPX_STRING_ADDR(addr, net, node, reply->socket);
+		
+		log_printf(LOG_DEBUG, "Resolved %s to %s:%hu", addr, inet_ntoa(src_ip.sin_addr), ntohs(src_ip.sin_port));
+	}
+	
+	addr_cache_set((struct sockaddr*)(&src_ip), sizeof(src_ip), net, node, reply->socket, iface_net, iface_node);
+	
+	STAT_ADD(stats.resolve_replies, 1);
+}
+
+/* Broadcast an IPX_MAGIC_ANNOUNCE packet on each interface, listing the IPX
+ * sockets this process has bound to it. Called periodically by the router
+ * thread and whenever a socket is bound, does nothing if announcements are
+ * disabled.
+*/
+void router_announce(void)
+{
+	if(ipx_use_pcap || main_config.announce_interval == 0)
+	{
+		return;
+	}
+	
+	last_announce = get_ticks();
+	
+	char buf[sizeof(ipx_packet) - 1 + sizeof(announce_msg_t) + (ANNOUNCE_MAX_SOCKETS * sizeof(uint16_t))];
+	
+	ipx_packet *packet  = (ipx_packet*)(buf);
+	announce_msg_t *msg = (announce_msg_t*)(packet->data);
+	
+	ipx_interface_t *ifaces = get_ipx_interfaces(), *iface;
+	
+	DL_FOREACH(ifaces, iface)
+	{
+		memset(buf, 0, sizeof(ipx_packet) - 1 + sizeof(announce_msg_t));
+		
+		packet->ptype = IPX_MAGIC_ANNOUNCE;
 		
-		if((dest_net == BCAST_NET || dest_node == BCAST_NODE)
-			&& !(sock->flags & IPX_RECV_BCAST))
-		{
-			/* Packet destination address includes a broadcast part
-			 * and this socket has explicitly disabled reception of
-			 * broadcasts.
-			*/
-			continue;
-		}
+		addr32_out(packet->src_net, iface->ipx_net);
+		addr48_out(packet->src_node, iface->ipx_node);
+		packet->src_socket = 0;
 		
-		if((dest_net == BCAST_NET || dest_node == BCAST_NODE)
-			&& (main_config.w95_bug && !(sock->flags & IPX_BROADCAST)))
-		{
-			/* Packet destination address includes a broadcast part,
-			 * socket has not enabled the SO_BROADCAST option and
-			 * the Windows 95 SO_BROADCAST bug is being emulated.
-			*/
-			continue;
-		}
+		/* The snapshot is sorted by socket number, so any socket which
+		 * is bound more than once is only listed once.
+		*/
 		
-		if((sock->flags & IPX_CONNECTED)
-			&& (src_net != addr32_in(sock->remote_addr.sa_netnum)
-			|| src_node != addr48_in(sock->remote_addr.sa_nodenum)
-			|| src_socket != sock->remote_addr.sa_socket))
-		{
-			/* Socket is "connected" and the source address isn't
-			 * the remote address of the socket.
-			*/
-			continue;
-		}
+		uint16_t n_sockets = 0;
 		
-		log_printf(LOG_DEBUG, "...relaying to local port %hu", ntohs(sock->port));
+		epoch_enter();
 		
-		size_t packet_size = (sizeof(ipx_packet) + data_size) - 1;
+		const ipx_socket_snapshot *snapshot = get_socket_snapshot();
 		
-		ipx_packet *packet = malloc(packet_size);
-		if(!packet)
+		for(size_t i = 0; snapshot && i < snapshot->n_recv_sockets && n_sockets < ANNOUNCE_MAX_SOCKETS; ++i)
 		{
-			log_printf(LOG_ERROR, "Cannot allocate memory!");
-			continue;
+			const ipx_socket_view *s = &(snapshot->recv_sockets[i]);
+			
+			if(addr32_in(s->addr.sa_netnum) == iface->ipx_net
+				&& addr48_in(s->addr.sa_nodenum) == iface->ipx_node
+				&& (n_sockets == 0 || msg->sockets[n_sockets - 1] != s->addr.sa_socket))
+			{
+				msg->sockets[n_sockets++] = s->addr.sa_socket;
+			}
 		}
 		
-		packet->ptype = type;
-		
-		addr32_out(packet->dest_net, dest_net);
-		addr48_out(packet->dest_node, dest_node);
-		packet->dest_socket = dest_socket;
-		
-		addr32_out(packet->src_net, src_net);
-		addr48_out(packet->src_node, src_node);
-		packet->src_socket = src_socket;
+		epoch_leave();
 		
-		packet->size = data_size;
-		memcpy(packet->data, data, data_size);
+		msg->n_sockets = htons(n_sockets);
 		
-		struct sockaddr_in send_addr;
+		size_t data_size = sizeof(announce_msg_t) + (n_sockets * sizeof(uint16_t));
+		packet->size = htons(data_size);
 		
-		send_addr.sin_family      = AF_INET;
-		send_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-		send_addr.sin_port        = sock->port;
+		ipx_interface_ip_t *ip;
 		
-		if(sendto(private_socket, (void*)(packet), packet_size, 0, (struct sockaddr*)(&send_addr), sizeof(send_addr)) == -1)
+		DL_FOREACH(iface->ipaddr, ip)
 		{
-			log_printf(LOG_ERROR, "Error relaying packet: %s", w32_error(WSAGetLastError()));
+			struct sockaddr_in bcast;
+			
+			bcast.sin_family      = AF_INET;
+			bcast.sin_port        = htons(main_config.udp_port);
+			bcast.sin_addr.s_addr = ip->bcast;
+			
+			if(r_sendto(private_socket, buf, sizeof(ipx_packet) - 1 + data_size, 0, (struct sockaddr*)(&bcast), sizeof(bcast)) == -1)
+			{
+				log_printf(LOG_ERROR, "Cannot send IPX_MAGIC_ANNOUNCE packet: %s", w32_error(WSAGetLastError()));
+			}
+			else{
+				STAT_ADD(stats.announces_sent, 1);
+			}
 		}
+	}
+	
+	free_ipx_interface_list(&ifaces);
+}
+
+/* Called by the router thread each time it wakes up. */
+static void _announce_tick(void)
+{
+	if(main_config.announce_interval != 0
+		&& (get_ticks() - last_announce) >= (uint64_t)(main_config.announce_interval) * 1000)
+	{
+		router_announce();
+	}
+}
+
+/* Called by the router thread each time it wakes up. */
+static void _addr_cache_save_tick(void)
+{
+	if(main_config.persist_addr_cache
+		&& (get_ticks() - last_addr_cache_save) >= ADDR_CACHE_SAVE_INTERVAL * 1000)
+	{
+		addr_cache_save(ADDR_CACHE_FILE);
+		last_addr_cache_save = get_ticks();
+	}
+}
+
+/* Cache the address of the interface and every socket listed in an
+ * IPX_MAGIC_ANNOUNCE packet.
+*/
+static void _handle_announce(const ipx_packet *packet, size_t data_size, struct sockaddr_in src_ip)
+{
+	const announce_msg_t *msg = (const announce_msg_t*)(packet->data);
+	
+	if(data_size < sizeof(announce_msg_t)
+		|| data_size != sizeof(announce_msg_t) + (ntohs(msg->n_sockets) * sizeof(uint16_t)))
+	{
+		log_printf(LOG_DEBUG, "Recieved IPX_MAGIC_ANNOUNCE packet with %u byte payload, dropping", (unsigned int)(data_size));
+		
+		STAT_ADD(stats.drop_bad_size, 1);
+		return;
+	}
+	
+	if(src_ip.sin_port == private_port && ipx_interface_is_local_ip(src_ip.sin_addr.s_addr))
+	{
+		STAT_ADD(stats.drop_own_packet, 1);
+		return;
+	}
+	
+	addr32_t net  = addr32_in(packet->src_net);
+	addr48_t node = addr48_in(packet->src_node);
+	
+	addr32_t iface_net;
+	addr48_t iface_node;
+	
+	if(!ipx_interface_has_subnet(src_ip.sin_addr.s_addr, true, net, node, &iface_net, &iface_node))
+	{
+		log_printf(LOG_DEBUG, "IPX_MAGIC_ANNOUNCE packet did not come from an expected subnet, dropping");
 		
-		free(packet);
+		STAT_ADD(stats.drop_bad_subnet, 1);
+		return;
+	}
+	
+	addr_cache_set((struct sockaddr*)(&src_ip), sizeof(src_ip), net, node, 0, iface_net, iface_node);
+	
+	for(uint16_t i = 0; i < ntohs(msg->n_sockets); ++i)
+	{
+		addr_cache_set((struct sockaddr*)(&src_ip), sizeof(src_ip), net, node, msg->sockets[i], iface_net, iface_node);
 	}
 	
-	unlock_sockets();
+	STAT_ADD(stats.announces_received, 1);
 }
 
 static void _handle_udp_recv(ipx_packet *packet, size_t packet_size, struct sockaddr_in src_ip)
 {
+	if(packet_size >= sizeof(ipx_packet) - 1 && packet->src_socket == 0 && packet->ptype == IPX_MAGIC_RELAY)
+	{
+		_handle_relayed(packet, packet_size, src_ip);
+		return;
+	}
+	
+	STAT_ADD(stats.rx_packets, 1);
+	STAT_ADD(stats.rx_bytes, packet_size);
+	
 	size_t data_size = ntohs(packet->size);
 	
 	if(packet_size < sizeof(ipx_packet) - 1 || data_size > MAX_DATA_SIZE || data_size + sizeof(ipx_packet) - 1 != packet_size)
 	{
 		/* Packet size field is incorrect. */
+		STAT_ADD(stats.drop_bad_size, 1);
 		return;
 	}
 	
@@ -349,24 +1507,27 @@ static void _handle_udp_recv(ipx_packet *packet, size_t packet_size, struct sock
 			if(data_size != sizeof(spxlookup_req_t))
 			{
 				log_printf(LOG_DEBUG, "Recieved IPX_MAGIC_SPXLOOKUP packet with %hu byte payload, dropping", data_size);
+				
+				STAT_ADD(stats.drop_bad_size, 1);
 				return;
 			}
 			
 			spxlookup_req_t *req = (spxlookup_req_t*)(packet->data);
 			
-			/* Search the sockets table for a listening socket which
-			 * is bound to the requested address.
+			/* Search the socket snapshot for a listening socket
+			 * which is bound to the requested address.
 			*/
 			
-			lock_sockets();
+			epoch_enter();
 			
-			ipx_socket *s, *tmp;
-			HASH_ITER(hh, sockets, s, tmp)
+			const ipx_socket_snapshot *snapshot = get_socket_snapshot();
+			
+			for(size_t i = 0; snapshot && i < snapshot->n_spx_listeners; ++i)
 			{
+				const ipx_socket_view *s = &(snapshot->spx_listeners[i]);
+				
 				if(
-					s->flags & IPX_IS_SPX
-					&& s->flags & IPX_LISTENING
-					&& (memcmp(req->net, s->addr.sa_netnum, 4) == 0
+					(memcmp(req->net, s->addr.sa_netnum, 4) == 0
 						|| addr32_in(req->net) == ZERO_NET)
 					&& memcmp(req->node, s->addr.sa_nodenum, 6) == 0
 					&& req->socket == s->addr.sa_socket)
@@ -384,7 +1545,7 @@ static void _handle_udp_recv(ipx_packet *packet, size_t packet_size, struct sock
 					
 					reply.port = s->port;
 					
-					if(sendto(private_socket, (char*)(&reply), sizeof(reply), 0, (struct sockaddr*)(&src_ip), sizeof(src_ip)) == -1)
+					if(r_sendto(private_socket, (char*)(&reply), sizeof(reply), 0, (struct sockaddr*)(&src_ip), sizeof(src_ip)) == -1)
 					{
 						log_printf(LOG_ERROR, "Cannot send spxlookup_reply packet: %s", w32_error(WSAGetLastError()));
 					}
@@ -393,10 +1554,37 @@ static void _handle_udp_recv(ipx_packet *packet, size_t packet_size, struct sock
 				}
 			}
 			
-			unlock_sockets();
+			epoch_leave();
+		}
+		else if(packet->ptype == IPX_MAGIC_RESOLVE || packet->ptype == IPX_MAGIC_RESOLVE_REPLY)
+		{
+			/* The other system is trying to find the address of
+			 * an IPX socket, or answering our own request.
+			*/
+			
+			if(data_size != sizeof(resolve_msg_t))
+			{
+				log_printf(LOG_DEBUG, "Recieved IPX_MAGIC_RESOLVE packet with %hu byte payload, dropping", data_size);
+				
+				STAT_ADD(stats.drop_bad_size, 1);
+				return;
+			}
+			
+			if(packet->ptype == IPX_MAGIC_RESOLVE)
+			{
+				_handle_resolve((resolve_msg_t*)(packet->data), src_ip);
+			}
+			else{
+				_handle_resolve_reply((resolve_msg_t*)(packet->data), src_ip);
+			}
+		}
+		else if(packet->ptype == IPX_MAGIC_ANNOUNCE)
+		{
+			_handle_announce(packet, data_size, src_ip);
 		}
 		else{
 			log_printf(LOG_DEBUG, "Recieved magic packet unknown ptype %u, dropping", (unsigned int)(packet->ptype));
+			STAT_ADD(stats.drop_unknown_magic, 1);
 		}
 		
 		return;
@@ -410,53 +1598,63 @@ static void _handle_udp_recv(ipx_packet *packet, size_t packet_size, struct sock
 		log_printf(LOG_DEBUG, "Recieved packet from %s (%s) for %s", src_addr, inet_ntoa(src_ip.sin_addr), dest_addr);
 	}
 	
+	if(src_ip.sin_port == private_port && ipx_interface_is_local_ip(src_ip.sin_addr.s_addr))
+	{
+		/* Packet was sent by this process, any local sockets which
+		 * should receive it already have it from
+		 * router_deliver_local().
+		*/
+		
+		log_printf(LOG_DEBUG, "Packet was sent by this process, dropping");
+		
+		STAT_ADD(stats.drop_own_packet, 1);
+		return;
+	}
+	
 	/* Check that the source IP of the UDP packet is within the subnet of a
 	 * valid interface. IPX broadcast packets will be accepted on any
 	 * enabled interface, unicast only on the interface with the destination
 	 * address.
 	*/
 	
-	ipx_interface_t *allow_interfaces;
-	BOOL source_ok = FALSE;
-	
-	if(addr48_in(packet->dest_node) == BCAST_NODE)
-	{
-		allow_interfaces = get_ipx_interfaces();
-	}
-	else{
-		allow_interfaces = ipx_interface_by_addr(
-			addr32_in(packet->dest_net), addr48_in(packet->dest_node));
-	}
-	
-	ipx_interface_t *i;
-	DL_FOREACH(allow_interfaces, i)
-	{
-		ipx_interface_ip_t *ip;
-		DL_FOREACH(i->ipaddr, ip)
-		{
-			if((ip->ipaddr & ip->netmask) == (src_ip.sin_addr.s_addr & ip->netmask))
-			{
-				source_ok = TRUE;
-			}
-		}
-	}
+	addr32_t iface_net;
+	addr48_t iface_node;
 	
-	free_ipx_interface_list(&allow_interfaces);
+	bool source_ok = ipx_interface_has_subnet(
+		src_ip.sin_addr.s_addr,
+		(addr48_in(packet->dest_node) == BCAST_NODE),
+		addr32_in(packet->dest_net), addr48_in(packet->dest_node),
+		&iface_net, &iface_node);
 	
 	if(!source_ok)
 	{
 		log_printf(LOG_DEBUG, "Packet did not come from an expected subnet, dropping");
+		
+		STAT_ADD(stats.drop_bad_subnet, 1);
 		return;
 	}
 	
+	_iface_stats_add(iface_net, iface_node, packet_size);
+	
 	/* Packet appears to have arrived from where we expect. Cache the source
 	 * IP address and destination IPX address so future send operations to
-	 * that IPX address can be unicast.
+	 * that IPX address can be unicast, preferably from the same interface.
+	*/
+	
+	addr_cache_set(
+		(struct sockaddr*)(&src_ip), sizeof(src_ip),
+		addr32_in(packet->src_net), addr48_in(packet->src_node), packet->src_socket,
+		iface_net, iface_node
+	);
+	
+	/* Also cache it as the default for the source host, so the first packet
+	 * to any other socket there can be unicast too.
 	*/
 	
 	addr_cache_set(
 		(struct sockaddr*)(&src_ip), sizeof(src_ip),
-		addr32_in(packet->src_net), addr48_in(packet->src_node), packet->src_socket
+		addr32_in(packet->src_net), addr48_in(packet->src_node), 0,
+		iface_net, iface_node
 	);
 	
 	_deliver_packet(packet->ptype,
@@ -469,29 +1667,55 @@ static void _handle_udp_recv(ipx_packet *packet, size_t packet_size, struct sock
 		packet->dest_socket,
 		
 		packet->data,
-		data_size);
+		data_size,
+		true);
 }
 
-static bool _do_udp_recv(int fd)
+/* Read and handle datagrams from a UDP socket until it would block or the
+ * budget is used up. If the budget runs out, the next recvfrom() call
+ * re-signals router_event so the remaining datagrams are read on the next
+ * wakeup, after any other sockets have had their turn.
+ *
+ * Returns the number of datagrams handled, -1 on error.
+*/
+static int _do_udp_recv(int fd, unsigned int budget)
 {
-	struct sockaddr_in addr;
-	int addrlen = sizeof(addr);
+	static char buf[MAX_RELAY_PKT_SIZE];
+	unsigned int handled = 0;
 	
-	char buf[MAX_PKT_SIZE];
-	int len = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr*)(&addr), &addrlen);
-	if(len == -1)
+	while(handled < budget)
 	{
-		if(WSAGetLastError() == WSAEWOULDBLOCK || WSAGetLastError() == WSAECONNRESET)
+		struct sockaddr_in addr;
+		int addrlen = sizeof(addr);
+		
+		int len = r_recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr*)(&addr), &addrlen);
+		if(len == -1)
 		{
-			return true;
+			if(WSAGetLastError() == WSAEWOULDBLOCK)
+			{
+				break;
+			}
+			else if(WSAGetLastError() == WSAECONNRESET)
+			{
+				/* ICMP port unreachable from an earlier send, there
+				 * may still be datagrams queued behind it.
+				*/
+				continue;
+			}
+			
+			return -1;
 		}
 		
-		return false;
+		if(router_master && fd == shared_socket)
+		{
+			_relay_to_procs(buf, len, addr);
+		}
+		
+		_handle_udp_recv((ipx_packet*)(buf), len, addr);
+		++handled;
 	}
 	
-	_handle_udp_recv((ipx_packet*)(buf), len, addr);
-	
-	return true;
+	return handled;
 }
 
 static void _handle_pcap_frame(u_char *user, const struct pcap_pkthdr *pkt_header, const u_char *pkt_data)
@@ -528,15 +1752,20 @@ static void _handle_pcap_frame(u_char *user, const struct pcap_pkthdr *pkt_heade
 			break;
 	}
 	
+	STAT_ADD(stats.rx_packets, 1);
+	STAT_ADD(stats.rx_bytes, ipx_len);
+	
 	if(ipx->checksum != 0xFFFF)
 	{
 		/* The "checksum" field doesn't have the magic IPX value. */
+		STAT_ADD(stats.drop_bad_frame, 1);
 		return;
 	}
 	
 	if(ntohs(ipx->length) > ipx_len)
 	{
 		/* The "length" field in the IPX header is too big. */
+		STAT_ADD(stats.drop_bad_frame, 1);
 		return;
 	}
 	
@@ -553,6 +1782,8 @@ static void _handle_pcap_frame(u_char *user, const struct pcap_pkthdr *pkt_heade
 		}
 	}
 	
+	_iface_stats_add(iface->ipx_net, iface->ipx_node, ipx_len);
+	
 	_deliver_packet(ipx->type,
 		addr32_in(ipx->src_net),
 		addr48_in(ipx->src_node),
@@ -563,7 +1794,8 @@ static void _handle_pcap_frame(u_char *user, const struct pcap_pkthdr *pkt_heade
 		ipx->dest_socket,
 		
 		ipx->data,
-		(ntohs(ipx->length) - sizeof(novell_ipx_packet)));
+		(ntohs(ipx->length) - sizeof(novell_ipx_packet)),
+		true);
 }
 
 static DWORD router_main(void *arg)
@@ -575,6 +1807,19 @@ static DWORD router_main(void *arg)
 	HANDLE *wait_events = &router_event;
 	int n_events = 1;
 	
+	/* When using the shared router, wait on the mutex as well as the event
+	 * until this process becomes the master.
+	*/
+	
+	HANDLE udp_events[2] = { router_event, router_mutex };
+	time_t last_reap = time(NULL);
+	
+	if(router_mutex)
+	{
+		wait_events = udp_events;
+		n_events = 2;
+	}
+	
 	if(ipx_use_pcap)
 	{
 		interfaces = get_ipx_interfaces();
@@ -605,14 +1850,31 @@ static DWORD router_main(void *arg)
 	
 	while(1)
 	{
-		WaitForMultipleObjects(n_events, wait_events, FALSE, 1000);
+		DWORD wait = WaitForMultipleObjects(n_events, wait_events, FALSE, 1000);
 		WSAResetEvent(router_event);
 		
+		addr_cache_tick();
+		_announce_tick();
+		_addr_cache_save_tick();
+		
+		if(router_mutex && !router_master
+			&& (wait == WAIT_OBJECT_0 + 1 || wait == WAIT_ABANDONED_0 + 1))
+		{
+			_become_master(wait == WAIT_ABANDONED_0 + 1);
+			n_events = 1;
+		}
+		
 		if(!router_running)
 		{
 			break;
 		}
 		
+		if(router_master && time(NULL) - last_reap >= ROUTER_SHM_REAP_INTERVAL)
+		{
+			_reap_shm_slots();
+			last_reap = time(NULL);
+		}
+		
 		if(ipx_use_pcap)
 		{
 			ipx_interface_t *i;
@@ -629,11 +1891,19 @@ static DWORD router_main(void *arg)
 			}
 		}
 		else{
-			if(!_do_udp_recv(shared_socket) || !_do_udp_recv(private_socket))
+			int shared_n  = (shared_socket != -1)
+				? _do_udp_recv(shared_socket, main_config.router_batch)
+				: 0;
+			
+			int private_n = _do_udp_recv(private_socket, main_config.router_batch);
+			
+			if(shared_n == -1 || private_n == -1)
 			{
 				exit_status = 1;
 				break;
 			}
+			
+			_batch_hist_add(shared_n + private_n);
 		}
 	}
 	
@@ -643,5 +1913,135 @@ static DWORD router_main(void *arg)
 		free_ipx_interface_list(&interfaces);
 	}
 	
+	_release_master();
+	
+	return exit_status;
+}
+
+/* Post an overlapped receive using the given buffer. */
+static bool _iocp_post_recv(struct iocp_recv *recv)
+{
+	while(1)
+	{
+		memset(&(recv->overlapped), 0, sizeof(recv->overlapped));
+		
+		recv->wsabuf.buf = recv->buf;
+		recv->wsabuf.len = sizeof(recv->buf);
+		
+		recv->addrlen = sizeof(recv->addr);
+		recv->flags   = 0;
+		
+		if(WSARecvFrom(recv->sock, &(recv->wsabuf), 1, NULL, &(recv->flags), (struct sockaddr*)(&(recv->addr)), &(recv->addrlen), &(recv->overlapped), NULL) == 0
+			|| WSAGetLastError() == WSA_IO_PENDING)
+		{
+			++iocp_pending;
+			return true;
+		}
+		
+		if(WSAGetLastError() != WSAECONNRESET)
+		{
+			log_printf(LOG_ERROR, "Error posting UDP receive: %s", w32_error(WSAGetLastError()));
+			return false;
+		}
+	}
+}
+
+static DWORD router_main_iocp(void *arg)
+{
+	DWORD exit_status = 0;
+	
+	/* The receives are posted from this thread rather than in router_init()
+	 * since, prior to Vista, pending I/O is cancelled when the thread which
+	 * issued it exits.
+	*/
+	
+	for(unsigned int i = 0; i < (2 * IOCP_RECVS_PER_SOCKET) && exit_status == 0; ++i)
+	{
+		if(!_iocp_post_recv(&(iocp_recvs[i])))
+		{
+			exit_status = 1;
+		}
+	}
+	
+	while(exit_status == 0)
+	{
+		DWORD bytes;
+		ULONG_PTR key;
+		OVERLAPPED *overlapped;
+		
+		BOOL ok = GetQueuedCompletionStatus(router_iocp, &bytes, &key, &overlapped, 1000);
+		
+		addr_cache_tick();
+		_announce_tick();
+		_addr_cache_save_tick();
+		
+		if(overlapped)
+		{
+			--iocp_pending;
+		}
+		
+		if(!router_running)
+		{
+			break;
+		}
+		
+		if(!overlapped && GetLastError() == WAIT_TIMEOUT)
+		{
+			/* Woke up to keep the address cache clock ticking. */
+			continue;
+		}
+		
+		if(!overlapped)
+		{
+			log_printf(LOG_ERROR, "GetQueuedCompletionStatus error: %s", w32_error(GetLastError()));
+			
+			exit_status = 1;
+			break;
+		}
+		
+		struct iocp_recv *recv = (struct iocp_recv*)(overlapped);
+		
+		if(ok)
+		{
+			_handle_udp_recv((ipx_packet*)(recv->buf), bytes, recv->addr);
+		}
+		else{
+			/* Most likely an ICMP port unreachable from an earlier
+			 * send, or an oversized datagram.
+			*/
+			
+			log_printf(LOG_DEBUG, "UDP receive failed: %s", w32_error(GetLastError()));
+		}
+		
+		if(!_iocp_post_recv(recv))
+		{
+			exit_status = 1;
+		}
+	}
+	
+	/* Cancel any receives still pending and wait for them to be returned
+	 * so router_cleanup() can release the buffers.
+	*/
+	
+	CancelIo((HANDLE)(shared_socket));
+	CancelIo((HANDLE)(private_socket));
+	
+	while(iocp_pending > 0)
+	{
+		DWORD bytes;
+		ULONG_PTR key;
+		OVERLAPPED *overlapped;
+		
+		if(!GetQueuedCompletionStatus(router_iocp, &bytes, &key, &overlapped, 1000) && !overlapped)
+		{
+			break;
+		}
+		
+		if(overlapped)
+		{
+			--iocp_pending;
+		}
+	}
+	
 	return exit_status;
 }
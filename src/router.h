@@ -23,10 +23,132 @@
 #include <wsipx.h>
 #include <stdint.h>
 
+#include "addr.h"
+
+/* Private socket options for retrieving router statistics, in a range which
+ * isn't used by any version of Windows. Both are valid at the NSPROTO_IPX
+ * level on any IPX socket.
+ * 
+ * IPXWRAPPER_ROUTER_STATS returns a struct router_stats for the process.
+ * IPXWRAPPER_SOCKET_STATS returns a struct ipx_socket_stats for the socket.
+*/
+
+#define IPXWRAPPER_ROUTER_STATS 0x4F00
+#define IPXWRAPPER_SOCKET_STATS 0x4F01
+
+/* Counters for the process as a whole.
+ * 
+ * rx:        UDP datagrams/frames received by the router.
+ * delivered: Packets relayed to at least one local socket.
+ * relayed:   Copies of packets relayed to local sockets.
+ * 
+ * The drop_XXX counters count packets discarded for each reason, those which
+ * are specific to a socket are counted once for each socket. drop_own_packet
+ * counts packets sent by this process which came back from the network after
+ * already being delivered to local sockets by router_deliver_local().
+ * 
+ * shared_relayed_packets counts copies of packets relayed to other processes
+ * by the shared router master, drop_bad_relay counts relayed packets which
+ * were rejected by this process.
+ * 
+ * resolve_replies_sent counts IPX_MAGIC_RESOLVE requests answered by this
+ * process, resolve_replies counts answers to its own requests which were
+ * added to the address cache and drop_bad_resolve counts answers which were
+ * unsolicited or came from an unexpected subnet.
+ * 
+ * announces_sent and announces_received count IPX_MAGIC_ANNOUNCE packets.
+*/
+
+#define ROUTER_STATS_COUNTERS(X) \
+	X(rx_packets) \
+	X(rx_bytes) \
+	X(delivered_packets) \
+	X(delivered_bytes) \
+	X(relayed_packets) \
+	X(relayed_bytes) \
+	X(drop_bad_size) \
+	X(drop_bad_frame) \
+	X(drop_bad_subnet) \
+	X(drop_unknown_magic) \
+	X(drop_no_recipient) \
+	X(drop_filter_ptype) \
+	X(drop_bcast_disabled) \
+	X(drop_w95_bug) \
+	X(drop_remote_addr) \
+	X(drop_ring_full) \
+	X(drop_relay_error) \
+	X(drop_own_packet) \
+	X(drop_bad_relay) \
+	X(shared_relayed_packets) \
+	X(resolve_replies_sent) \
+	X(resolve_replies) \
+	X(drop_bad_resolve) \
+	X(announces_sent) \
+	X(announces_received)
+
+#define ROUTER_MAX_IFACE_STATS 16
+
+struct router_iface_stats {
+	unsigned char net[4];
+	unsigned char node[6];
+	
+	uint64_t rx_packets;
+	uint64_t rx_bytes;
+};
+
+#define ROUTER_STATS_FIELD(name) uint64_t name;
+
+struct router_stats {
+	ROUTER_STATS_COUNTERS(ROUTER_STATS_FIELD)
+	
+	/* Packets accepted on each IPX interface, in the order each was
+	 * first seen.
+	*/
+	uint32_t n_ifaces;
+	struct router_iface_stats ifaces[ROUTER_MAX_IFACE_STATS];
+};
+
+/* Counters for a single IPX socket. */
+
+#define SOCKET_STATS_COUNTERS(X) \
+	X(relayed_packets) \
+	X(relayed_bytes) \
+	X(drop_filter_ptype) \
+	X(drop_bcast_disabled) \
+	X(drop_w95_bug) \
+	X(drop_remote_addr) \
+	X(drop_ring_full) \
+	X(drop_relay_error)
+
+struct ipx_socket_stats {
+	SOCKET_STATS_COUNTERS(ROUTER_STATS_FIELD)
+};
+
+struct ipx_socket_snapshot;
+
 extern SOCKET shared_socket;
 extern SOCKET private_socket;
 
 void router_init(void);
 void router_cleanup(void);
 
+void router_get_stats(struct router_stats *dest);
+void router_get_socket_stats(struct ipx_socket_stats *dest, struct ipx_socket_stats *src);
+
+void router_update_sockets(const struct ipx_socket_snapshot *snapshot);
+
+bool router_resolve_begin(addr32_t net, addr48_t node, uint16_t socket);
+void router_announce(void);
+
+int router_deliver_local(
+	uint8_t type,
+	addr32_t src_net,
+	addr48_t src_node,
+	uint16_t src_socket,
+	addr32_t dest_net,
+	addr48_t dest_node,
+	uint16_t dest_socket,
+	const void *data,
+	size_t data_size);
+
 #endif /* !IPXWRAPPER_ROUTER_H */
@@ -30,6 +30,12 @@
 #include "router.h"
 #include "addrcache.h"
 #include "ethernet.h"
+#include "epoch.h"
+
+/* Most broadcast addresses an SPX connection request or an IPX packet will be
+ * sent to.
+*/
+#define MAX_CONNECT_BCAST_ADDRS 64
 
 struct sockaddr_ipx_ext {
 	short sa_family;
@@ -310,10 +316,31 @@ SOCKET WSAAPI socket(int af, int type, int protocol)
 				return -1;
 			}
 			
+			if(!(nsock->stats = calloc(1, sizeof(struct ipx_socket_stats))))
+			{
+				free(nsock);
+				
+				WSASetLastError(ERROR_OUTOFMEMORY);
+				return -1;
+			}
+			
+			nsock->ring = NULL;
+			
+			if(main_config.ring_delivery && !(nsock->ring = pkt_ring_new(IPX_RING_SIZE)))
+			{
+				free(nsock->stats);
+				free(nsock);
+				
+				WSASetLastError(ERROR_OUTOFMEMORY);
+				return -1;
+			}
+			
 			if((nsock->fd = r_socket(AF_INET, SOCK_DGRAM, 0)) == -1)
 			{
 				log_printf(LOG_ERROR, "Cannot create UDP socket: %s", w32_error(WSAGetLastError()));
 				
+				pkt_ring_free(nsock->ring);
+				free(nsock->stats);
 				free(nsock);
 				return -1;
 			}
@@ -321,10 +348,13 @@ SOCKET WSAAPI socket(int af, int type, int protocol)
 			nsock->flags = IPX_SEND | IPX_RECV | IPX_RECV_BCAST;
 			nsock->s_ptype = (protocol ? protocol - NSPROTO_IPX : 0);
 			
+			nsock->index_list   = NULL;
+			nsock->index_bucket = NULL;
+			
 			log_printf(LOG_INFO, "IPX socket created (fd = %d)", nsock->fd);
 			
 			lock_sockets();
-			HASH_ADD_INT(sockets, fd, nsock);
+			add_socket(nsock);
 			unlock_sockets();
 			
 			return nsock->fd;
@@ -369,10 +399,16 @@ SOCKET WSAAPI socket(int af, int type, int protocol)
 				nsock->flags |= IPX_IS_SPXII;
 			}
 			
+			nsock->stats = NULL;
+			nsock->ring  = NULL;
+			
+			nsock->index_list   = NULL;
+			nsock->index_bucket = NULL;
+			
 			log_printf(LOG_INFO, "SPX socket created (fd = %d)", nsock->fd);
 			
 			lock_sockets();
-			HASH_ADD_INT(sockets, fd, nsock);
+			add_socket(nsock);
 			unlock_sockets();
 			
 			return nsock->fd;
@@ -389,6 +425,11 @@ SOCKET WSAAPI socket(int af, int type, int protocol)
 	}
 }
 
+static void _free_ring(void *ring)
+{
+	pkt_ring_free(ring);
+}
+
 int WSAAPI closesocket(SOCKET sockfd)
 {
 	int ret = r_closesocket(sockfd);
@@ -415,7 +456,22 @@ int WSAAPI closesocket(SOCKET sockfd)
 		CloseHandle(sock->sock_mut);
 	}
 	
-	HASH_DEL(sockets, sock);
+	remove_socket(sock);
+	
+	/* The router may still be counting packets against the socket in a
+	 * snapshot taken before it was removed from the index.
+	*/
+	
+	if(sock->stats)
+	{
+		epoch_retire(sock->stats, &free);
+	}
+	
+	if(sock->ring)
+	{
+		epoch_retire(sock->ring, &_free_ring);
+	}
+	
 	free(sock);
 	
 	unlock_sockets();
@@ -627,8 +683,14 @@ int WSAAPI bind(SOCKET fd, const struct sockaddr *addr, int addrlen)
 		sock->port = bind_addr.sin_port;
 		log_printf(LOG_DEBUG, "Bound to local port %hu", ntohs(sock->port));
 		
+		update_socket_index(sock);
+		
 		unlock_sockets();
 		
+		/* Let other hosts know about the new socket straight away. */
+		
+		router_announce();
+		
 		return 0;
 	}
 	else{
@@ -672,6 +734,59 @@ int WSAAPI getsockname(SOCKET fd, struct sockaddr *addr, int *addrlen)
 	}
 }
 
+/* Release the packet read by recv_packet() from a ring, removing it unless
+ * only peeking.
+ * 
+ * Doorbells may be lost, so the ring can hold more packets than there are
+ * doorbells waiting on the socket. If packets remain once this one is gone
+ * but no doorbell is waiting, send the socket one of our own so the rest
+ * are still woken up for.
+*/
+static void _recv_packet_done(pkt_ring_t *ring, SOCKET fd, uint16_t port, int flags)
+{
+	if(ring)
+	{
+		if(!(flags & MSG_PEEK))
+		{
+			pkt_ring_pop(ring);
+			
+			size_t len;
+			u_long waiting;
+			
+			if(pkt_ring_front(ring, &len)
+				&& r_ioctlsocket(fd, FIONREAD, &waiting) == 0 && waiting == 0)
+			{
+				struct sockaddr_in self;
+				self.sin_family      = AF_INET;
+				self.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+				self.sin_port        = port;
+				
+				const char doorbell[IPX_DOORBELL_SIZE] = { 0 };
+				
+				if(r_sendto(fd, doorbell, sizeof(doorbell), 0, (struct sockaddr*)(&self), sizeof(self)) == -1)
+				{
+					log_printf(LOG_WARNING, "Error sending doorbell: %s", w32_error(WSAGetLastError()));
+				}
+			}
+		}
+		
+		pkt_ring_unlock(ring);
+	}
+}
+
+/* Check whether a ring is empty. */
+static bool _ring_empty(pkt_ring_t *ring)
+{
+	pkt_ring_lock(ring);
+	
+	size_t len;
+	bool empty = !pkt_ring_front(ring, &len);
+	
+	pkt_ring_unlock(ring);
+	
+	return empty;
+}
+
 /* Recieve a packet from an IPX socket
  * addr must be NULL or a region of memory big enough for a sockaddr_ipx
  *
@@ -680,8 +795,10 @@ int WSAAPI getsockname(SOCKET fd, struct sockaddr *addr, int *addrlen)
 */
 static int recv_packet(ipx_socket *sockptr, char *buf, int bufsize, int flags, struct sockaddr_ipx_ext *addr, int addrlen) {
 	SOCKET fd = sockptr->fd;
+	uint16_t port = sockptr->port;
 	int is_bound = sockptr->flags & IPX_BOUND;
 	int extended_addr = sockptr->flags & IPX_EXT_ADDR;
+	pkt_ring_t *ring = sockptr->ring;
 	
 	unlock_sockets();
 	
@@ -690,25 +807,95 @@ static int recv_packet(ipx_socket *sockptr, char *buf, int bufsize, int flags, s
 		return -1;
 	}
 	
-	char *recvbuf = malloc(MAX_PKT_SIZE);
-	if(!recvbuf) {
-		WSASetLastError(ERROR_OUTOFMEMORY);
-		return -1;
-	}
+	char header_buf[IPX_PACKET_HEADER_SIZE];
+	const struct ipx_packet *packet;
+	bool valid;
 	
-	struct ipx_packet *packet = (struct ipx_packet*)(recvbuf);
-	
-	int rval = r_recv(fd, recvbuf, MAX_PKT_SIZE, flags);
-	if(rval == -1) {
-		free(recvbuf);
-		return -1;
+	if(ring)
+	{
+		/* The router sends a doorbell datagram to the socket after
+		 * adding each packet to the ring, so blocking, non-blocking
+		 * and peeking reads behave the same as with relayed packets.
+		 * 
+		 * A doorbell is only a wakeup and doesn't stand for any
+		 * particular packet, each one lets us read whatever is at
+		 * the front of the ring.
+		*/
+		
+		char doorbell[IPX_DOORBELL_SIZE];
+		size_t len;
+		
+		while(1)
+		{
+			if(r_recv(fd, doorbell, sizeof(doorbell), flags) == -1)
+			{
+				return -1;
+			}
+			
+			pkt_ring_lock(ring);
+			
+			if((packet = (const struct ipx_packet*)(pkt_ring_front(ring, &len))))
+			{
+				break;
+			}
+			
+			pkt_ring_unlock(ring);
+			
+			/* Packets behind a lost doorbell are read after the
+			 * next one, leaving a spare doorbell behind. Drop it
+			 * and wait for another, r_recv() fails by itself if
+			 * the socket is non-blocking.
+			*/
+			
+			log_printf(LOG_DEBUG, "Received doorbell with no packet in ring");
+			
+			if((flags & MSG_PEEK) && r_recv(fd, doorbell, sizeof(doorbell), (flags & ~MSG_PEEK)) == -1)
+			{
+				return -1;
+			}
+		}
+		
+		valid = len >= IPX_PACKET_HEADER_SIZE
+			&& len == ntohs(packet->size) + IPX_PACKET_HEADER_SIZE;
+	}
+	else{
+		/* Receive the header onto the stack and the payload straight
+		 * into the caller's buffer.
+		*/
+		
+		packet = (const struct ipx_packet*)(header_buf);
+		
+		WSABUF bufs[2] = {
+			{ .len = IPX_PACKET_HEADER_SIZE, .buf = header_buf },
+			{ .len = bufsize,                .buf = buf },
+		};
+		
+		DWORD received, recv_flags = flags;
+		
+		if(WSARecv(fd, bufs, 2, &received, &recv_flags, NULL, NULL) == 0)
+		{
+			valid = received >= IPX_PACKET_HEADER_SIZE
+				&& received == ntohs(packet->size) + IPX_PACKET_HEADER_SIZE;
+		}
+		else if(WSAGetLastError() == WSAEMSGSIZE)
+		{
+			/* The payload was truncated to fit the caller's
+			 * buffer, the header still holds its full size.
+			*/
+			
+			valid = ntohs(packet->size) > bufsize;
+		}
+		else{
+			return -1;
+		}
 	}
 	
-	if(rval < sizeof(ipx_packet) - 1 || rval != packet->size + sizeof(ipx_packet) - 1)
+	if(!valid)
 	{
 		log_printf(LOG_ERROR, "Invalid packet received on loopback port!");
 		
-		free(recvbuf);
+		_recv_packet_done(ring, fd, port, flags);
+		
 		WSASetLastError(WSAEWOULDBLOCK);
 		return -1;
 	}
@@ -742,14 +929,10 @@ static int recv_packet(ipx_socket *sockptr, char *buf, int bufsize, int flags, s
 				 * to be from one of our interfaces.
 				*/
 				
-				ipx_interface_t *src_iface = ipx_interface_by_addr(
+				if(ipx_interface_exists(
 					addr32_in(packet->src_net),
-					addr48_in(packet->src_node)
-				);
-				
-				if(src_iface)
+					addr48_in(packet->src_node)))
 				{
-					free_ipx_interface(src_iface);
 					addr->sa_flags |= 0x02;
 				}
 			}else{
@@ -758,9 +941,14 @@ static int recv_packet(ipx_socket *sockptr, char *buf, int bufsize, int flags, s
 		}
 	}
 	
-	memcpy(buf, packet->data, packet->size <= bufsize ? packet->size : bufsize);
-	rval = packet->size;
-	free(recvbuf);
+	int rval = ntohs(packet->size);
+	
+	if(ring)
+	{
+		memcpy(buf, packet->data, rval <= bufsize ? rval : bufsize);
+	}
+	
+	_recv_packet_done(ring, fd, port, flags);
 	
 	return rval;
 }
@@ -992,6 +1180,57 @@ int WSAAPI getsockopt(SOCKET fd, int level, int optname, char FAR *optval, int F
 			{
 				RETURN_BOOL_OPT(sock->flags & IPX_EXT_ADDR);
 			}
+			else if(optname == IPXWRAPPER_ROUTER_STATS)
+			{
+				GETSOCKOPT_OPTLEN(sizeof(struct router_stats));
+				
+				router_get_stats((struct router_stats*)(optval));
+				
+				unlock_sockets();
+				return 0;
+			}
+			else if(optname == IPXWRAPPER_SOCKET_STATS)
+			{
+				GETSOCKOPT_OPTLEN(sizeof(struct ipx_socket_stats));
+				
+				if(sock->stats)
+				{
+					router_get_socket_stats((struct ipx_socket_stats*)(optval), sock->stats);
+				}
+				else{
+					memset(optval, 0, sizeof(struct ipx_socket_stats));
+				}
+				
+				unlock_sockets();
+				return 0;
+			}
+			else if(optname == IPXWRAPPER_ADDR_CACHE_STATS)
+			{
+				GETSOCKOPT_OPTLEN(sizeof(struct addr_cache_stats));
+				
+				addr_cache_get_stats((struct addr_cache_stats*)(optval));
+				
+				unlock_sockets();
+				return 0;
+			}
+			else if(optname == IPXWRAPPER_ADDR_CACHE_DUMP)
+			{
+				if(*optlen < (int)(sizeof(struct addr_cache_file_header)))
+				{
+					*optlen = addr_cache_dump(NULL, 0);
+					
+					WSASetLastError(WSAEFAULT);
+					
+					unlock_sockets();
+					return -1;
+				}
+				
+				unlock_sockets();
+				
+				*optlen = addr_cache_dump(optval, *optlen);
+				
+				return 0;
+			}
 			else{
 				log_printf(LOG_ERROR, "Unknown NSPROTO_IPX socket option passed to getsockopt: %d", optname);
 				
@@ -1036,6 +1275,7 @@ int WSAAPI getsockopt(SOCKET fd, int level, int optname, char FAR *optval, int F
 	else{ \
 		sock->flags &= ~(flag); \
 	} \
+	update_socket_index(sock); \
 	unlock_sockets(); \
 	return 0;
 
@@ -1087,6 +1327,8 @@ int WSAAPI setsockopt(SOCKET fd, int level, int optname, const char FAR *optval,
 				sock->f_ptype = *intval;
 				sock->flags |= IPX_FILTER;
 				
+				update_socket_index(sock);
+				
 				unlock_sockets();
 				return 0;
 			}
@@ -1094,6 +1336,8 @@ int WSAAPI setsockopt(SOCKET fd, int level, int optname, const char FAR *optval,
 			{
 				sock->flags &= ~IPX_FILTER;
 				
+				update_socket_index(sock);
+				
 				unlock_sockets();
 				return 0;
 			}
@@ -1162,10 +1406,10 @@ int WSAAPI setsockopt(SOCKET fd, int level, int optname, const char FAR *optval,
 	return r;
 }
 
-/* Send an IPX packet to the specified address.
- * Returns true on success, false on failure.
+/* Send an IPX packet made up of the given header and payload to the specified
+ * address. Returns true on success, false on failure.
 */
-static int send_packet(const ipx_packet *packet, int len, struct sockaddr *addr, int addrlen)
+static int send_packet(const ipx_packet *header, const void *data, size_t data_size, struct sockaddr *addr, int addrlen)
 {
 	if(min_log_level <= LOG_DEBUG && addr->sa_family == AF_INET)
 	{
@@ -1173,22 +1417,34 @@ static int send_packet(const ipx_packet *packet, int len, struct sockaddr *addr,
 		
 		IPX_STRING_ADDR(
 			src_addr,
-			addr32_in(packet->src_net),
-			addr48_in(packet->src_node),
-			packet->src_socket
+			addr32_in(header->src_net),
+			addr48_in(header->src_node),
+			header->src_socket
 		);
 		
 		IPX_STRING_ADDR(
 			dest_addr,
-			addr32_in(packet->dest_net),
-			addr48_in(packet->dest_node),
-			packet->dest_socket
+			addr32_in(header->dest_net),
+			addr48_in(header->dest_node),
+			header->dest_socket
 		);
 		
 		log_printf(LOG_DEBUG, "Sending packet from %s to %s (%s:%hu)", src_addr, dest_addr, inet_ntoa(v4->sin_addr), ntohs(v4->sin_port));
 	}
 	
-	return (r_sendto(private_socket, (char*)packet, len, 0, addr, addrlen) == len);
+	/* The header and payload are sent as two buffers so the payload never
+	 * needs copying in behind the header.
+	*/
+	
+	WSABUF bufs[2] = {
+		{ .len = IPX_PACKET_HEADER_SIZE, .buf = (char*)(header) },
+		{ .len = data_size,              .buf = (char*)(data) },
+	};
+	
+	DWORD sent;
+	
+	return WSASendTo(private_socket, bufs, 2, &sent, 0, addr, addrlen, NULL, NULL) == 0
+		&& sent == IPX_PACKET_HEADER_SIZE + data_size;
 }
 
 static DWORD ipx_send_packet(
@@ -1212,8 +1468,8 @@ static DWORD ipx_send_packet(
 	
 	if(ipx_use_pcap)
 	{
-		ipx_interface_t *iface = ipx_interface_by_addr(src_net, src_node);
-		if(iface)
+		pcap_t *pcap = ipx_interface_pcap_by_addr(src_net, src_node);
+		if(pcap)
 		{
 			/* Calculate the frame size and check we can actually
 			 * fit this much data in it.
@@ -1251,7 +1507,7 @@ static DWORD ipx_send_packet(
 			
 			/* Serialise the frame. */
 			
-			void *frame = malloc(frame_size);
+			void *frame = get_send_buf();
 			if(!frame)
 			{
 				return ERROR_OUTOFMEMORY;
@@ -1286,15 +1542,13 @@ static DWORD ipx_send_packet(
 			
 			/* Transmit the frame. */
 			
-			if(pcap_sendpacket(iface->pcap, (void*)(frame), frame_size) == 0)
+			if(pcap_sendpacket(pcap, (void*)(frame), frame_size) == 0)
 			{
-				free(frame);
 				return ERROR_SUCCESS;
 			}
 			else{
 				log_printf(LOG_ERROR, "Could not transmit Ethernet frame");
 				
-				free(frame);
 				return WSAENETDOWN;
 			}
 		}
@@ -1304,28 +1558,38 @@ static DWORD ipx_send_packet(
 		}
 	}
 	else{
-		int packet_size = sizeof(ipx_packet) - 1 + data_size;
+		/* Deliver the packet straight to any sockets in this process
+		 * which should receive it. The router drops any packets sent
+		 * by this process which come back from the network, so it is
+		 * only passed to local sockets once.
+		 * 
+		 * Unicast packets which reached a local socket are done,
+		 * broadcasts also go out on the network.
+		*/
+		
+		int local_count = router_deliver_local(type,
+			src_net,  src_node,  src_socket,
+			dest_net, dest_node, dest_socket,
+			data, data_size);
 		
-		ipx_packet *packet = malloc(packet_size);
-		if(!packet)
+		if(local_count > 0 && dest_node != BCAST_NODE)
 		{
-			return ERROR_OUTOFMEMORY;
+			log_printf(LOG_DEBUG, "...delivered to %d local socket(s)", local_count);
+			return ERROR_SUCCESS;
 		}
 		
-		packet->ptype = type;
-		
-		addr32_out(packet->src_net, src_net);
-		addr48_out(packet->src_node, src_node);
-		packet->src_socket = src_socket;
-		
-		addr32_out(packet->dest_net, dest_net);
-		addr48_out(packet->dest_node, dest_node);
-		packet->dest_socket = dest_socket;
+		char header_buf[IPX_PACKET_HEADER_SIZE];
+		ipx_packet *header = (ipx_packet*)(header_buf);
 		
-		packet->size = htons(data_size);
-		memcpy(packet->data, data, data_size);
+		ipx_packet_header_pack(header,
+			type,
+			src_net,  src_node,  src_socket,
+			dest_net, dest_node, dest_socket,
+			data_size);
 		
-		/* Search the address cache for an IP address */
+		/* Search the address cache for an IP address. Broadcasts are
+		 * never cached, so don't look them up and count a miss.
+		*/
 		
 		SOCKADDR_STORAGE send_addr;
 		size_t addrlen;
@@ -1333,74 +1597,125 @@ static DWORD ipx_send_packet(
 		DWORD send_error = ERROR_SUCCESS;
 		BOOL send_ok     = FALSE;
 		
-		if(addr_cache_get(&send_addr, &addrlen, dest_net, dest_node, dest_socket))
+		if(dest_node != BCAST_NODE
+			&& addr_cache_get(&send_addr, &addrlen, dest_net, dest_node, dest_socket, src_net, src_node))
 		{
 			/* IP address is cached. We can send directly to the
 			 * host.
+			 *
+			 * If the host has been seen at more than one address
+			 * and the send fails, the failure moves the cache on to
+			 * the next best address, so try each of them in turn.
 			*/
 			
-			if(send_packet(
-				packet,
-				packet_size,
-				(struct sockaddr*)(&send_addr),
-				addrlen))
+			for(int i = 0; i < ADDR_CACHE_ENDPOINTS; ++i)
 			{
-				send_ok = TRUE;
-			}
-			else{
+				if(send_packet(
+					header,
+					data,
+					data_size,
+					(struct sockaddr*)(&send_addr),
+					addrlen))
+				{
+					send_ok = TRUE;
+					break;
+				}
+				
 				send_error = WSAGetLastError();
+				
+				addr_cache_send_failed((struct sockaddr*)(&send_addr), addrlen, dest_net, dest_node, dest_socket);
+				
+				if(!addr_cache_get(&send_addr, &addrlen, dest_net, dest_node, dest_socket, src_net, src_node))
+				{
+					break;
+				}
 			}
 		}
 		else{
-			/* No cached address. Send using broadcast. */
+			/* No cached address. Send using broadcast, along with
+			 * an IPX_MAGIC_RESOLVE request for unicast packets so
+			 * that later ones can be sent directly once the
+			 * destination answers.
+			*/
 			
-			ipx_interface_t *iface = ipx_interface_by_addr(src_net, src_node);
+			char resolve_buf[IPX_PACKET_HEADER_SIZE + sizeof(resolve_msg_t)];
+			ipx_packet *resolve = NULL;
 			
-			if(iface && iface->ipaddr)
+			if(dest_node != BCAST_NODE
+				&& router_resolve_begin(dest_net, dest_node, dest_socket))
 			{
-				/* Iterate over all the IPs associated
-				 * with this interface and return
-				 * success if the packet makes it out
-				 * through any of them.
-				*/
+				memset(resolve_buf, 0, sizeof(resolve_buf));
 				
-				ipx_interface_ip_t* ip;
+				resolve = (ipx_packet*)(resolve_buf);
 				
-				DL_FOREACH(iface->ipaddr, ip)
-				{
-					struct sockaddr_in bcast;
-					
-					bcast.sin_family      = AF_INET;
-					bcast.sin_port        = htons(main_config.udp_port);
-					bcast.sin_addr.s_addr = ip->bcast;
-					
-					if(send_packet(
-						packet,
-						packet_size,
-						(struct sockaddr*)(&bcast),
-						sizeof(bcast)))
-					{
-						send_ok = TRUE;
-					}
-					else{
-						send_error = WSAGetLastError();
-					}
-				}
+				resolve->ptype = IPX_MAGIC_RESOLVE;
+				
+				addr32_out(resolve->src_net, src_net);
+				addr48_out(resolve->src_node, src_node);
+				resolve->src_socket = 0;
+				
+				resolve->size = htons(sizeof(resolve_msg_t));
+				
+				resolve_msg_t *req = (resolve_msg_t*)(resolve->data);
+				
+				addr32_out(req->net, dest_net);
+				addr48_out(req->node, dest_node);
+				req->socket = dest_socket;
 			}
-			else{
+			
+			/* Send to the broadcast address of every IP
+			 * associated with the interface and return
+			 * success if the packet makes it out through
+			 * any of them.
+			*/
+			
+			uint32_t bcast_addrs[MAX_CONNECT_BCAST_ADDRS];
+			int n_bcast_addrs = ipx_interface_bcast_addrs(src_net, src_node,
+				bcast_addrs, MAX_CONNECT_BCAST_ADDRS);
+			
+			if(n_bcast_addrs == 0)
+			{
 				/* No IP addresses; can't transmit */
 				
-				free_ipx_interface(iface);
-				free(packet);
-				
 				return WSAENETUNREACH;
 			}
 			
-			free_ipx_interface(iface);
+			if(n_bcast_addrs > MAX_CONNECT_BCAST_ADDRS)
+			{
+				log_printf(LOG_WARNING, "Interface has %d IP addresses, only broadcasting to the first %d",
+					n_bcast_addrs, MAX_CONNECT_BCAST_ADDRS);
+				
+				n_bcast_addrs = MAX_CONNECT_BCAST_ADDRS;
+			}
+			
+			for(int i = 0; i < n_bcast_addrs; ++i)
+			{
+				struct sockaddr_in bcast;
+				
+				bcast.sin_family      = AF_INET;
+				bcast.sin_port        = htons(main_config.udp_port);
+				bcast.sin_addr.s_addr = bcast_addrs[i];
+				
+				if(resolve)
+				{
+					send_packet(resolve, resolve->data, sizeof(resolve_msg_t), (struct sockaddr*)(&bcast), sizeof(bcast));
+				}
+				
+				if(send_packet(
+					header,
+					data,
+					data_size,
+					(struct sockaddr*)(&bcast),
+					sizeof(bcast)))
+				{
+					send_ok = TRUE;
+				}
+				else{
+					send_error = WSAGetLastError();
+				}
+			}
 		}
 		
-		free(packet);
-		
 		return send_ok
 			? ERROR_SUCCESS
 			: send_error;
@@ -1419,7 +1734,7 @@ int WSAAPI sendto(SOCKET fd, const char *buf, int len, int flags, const struct s
 		{
 			unlock_sockets();
 			
-			return r_send(sock->fd, buf, len, flags);
+			return r_send(fd, buf, len, flags);
 		}
 		
 		if(!addr)
@@ -1504,10 +1819,15 @@ int WSAAPI sendto(SOCKET fd, const char *buf, int len, int flags, const struct s
 			dest_net = src_net;
 		}
 		
-		DWORD error = ipx_send_packet(type, src_net, src_node, src_socket, dest_net, dest_node, dest_socket, buf, len);
+		/* Everything needed from the socket has been copied, so other
+		 * threads can use the sockets table while the packet is
+		 * encoded and transmitted.
+		*/
 		
 		unlock_sockets();
 		
+		DWORD error = ipx_send_packet(type, src_net, src_node, src_socket, dest_net, dest_node, dest_socket, buf, len);
+		
 		if(error == ERROR_SUCCESS)
 		{
 			return len;
@@ -1544,6 +1864,8 @@ int PASCAL shutdown(SOCKET fd, int cmd)
 				sock->flags &= ~IPX_SEND;
 			}
 			
+			update_socket_index(sock);
+			
 			unlock_sockets();
 			return 0;
 		}
@@ -1586,6 +1908,22 @@ int PASCAL ioctlsocket(SOCKET fd, long cmd, u_long *argp)
 				return -1;
 			}
 			
+			if(sock->ring && _ring_empty(sock->ring))
+			{
+				/* Only a spare doorbell is waiting, see
+				 * recv_packet(). Drop it rather than blocking
+				 * in recv_packet() for the next one.
+				*/
+				
+				char doorbell[IPX_DOORBELL_SIZE];
+				r_recv(sock->fd, doorbell, sizeof(doorbell), 0);
+				
+				*(unsigned long*)(argp) = 0;
+				
+				unlock_sockets();
+				return 0;
+			}
+			
 			/* Get the size of the packet. */
 			
 			char tmp_buf;
@@ -1605,8 +1943,6 @@ int PASCAL ioctlsocket(SOCKET fd, long cmd, u_long *argp)
 	return r_ioctlsocket(fd, cmd, argp);
 }
 
-#define MAX_CONNECT_BCAST_ADDRS 64
-
 static void _connect_bcast_push(uint32_t *bcast_addrs, int *bcast_count, ipx_interface_ip_t *ips)
 {
 	ipx_interface_ip_t *ip;
@@ -1712,15 +2048,10 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 	memcpy(req.node, ipxaddr->sa_nodenum, 6);
 	req.socket = ipxaddr->sa_socket;
 	
-	size_t packet_len  = sizeof(ipx_packet) - 1 + sizeof(req);
-	ipx_packet *packet = malloc(packet_len);
-	if(!packet)
-	{
-		unlock_sockets();
-		
-		WSASetLastError(ERROR_OUTOFMEMORY);
-		return -1;
-	}
+	char packet_buf[sizeof(ipx_packet) - 1 + sizeof(req)];
+	
+	size_t packet_len  = sizeof(packet_buf);
+	ipx_packet *packet = (ipx_packet*)(packet_buf);
 	
 	memset(packet, 0, sizeof(ipx_packet));
 	
@@ -1741,7 +2072,6 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 	{
 		log_printf(LOG_ERROR, "Cannot create UDP socket: %s", w32_error(WSAGetLastError()));
 		
-		free(packet);
 		unlock_sockets();
 		
 		return -1;
@@ -1763,7 +2093,6 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 		log_printf(LOG_ERROR, "Cannot bind UDP socket for SPX address lookup: %s", w32_error(WSAGetLastError()));
 		
 		closesocket(lookup_fd);
-		free(packet);
 		unlock_sockets();
 		
 		return -1;
@@ -1802,7 +2131,6 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 			/* Give up if none of them could be sent. */
 			
 			closesocket(lookup_fd);
-			free(packet);
 			unlock_sockets();
 			
 			WSASetLastError(WSAENETUNREACH);
@@ -1839,7 +2167,6 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 			if(select(1, &fdset, NULL, NULL, &tv) == -1)
 			{
 				closesocket(lookup_fd);
-				free(packet);
 				
 				return -1;
 			}
@@ -1855,7 +2182,6 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 				log_printf(LOG_DEBUG, "Application closed socket during connect!");
 				
 				closesocket(lookup_fd);
-				free(packet);
 				
 				if(reclaim_sock)
 				{
@@ -1910,7 +2236,6 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 	}
 	
 	closesocket(lookup_fd);
-	free(packet);
 	
 	if(!got_reply)
 	{
@@ -2114,6 +2439,8 @@ int PASCAL connect(SOCKET fd, const struct sockaddr *addr, int addrlen)
 			if(addrlen >= sizeof(addr->sa_family) && addr->sa_family == AF_UNSPEC)
 			{
 				sock->flags &= ~IPX_CONNECTED;
+				update_socket_index(sock);
+				
 				unlock_sockets();
 				
 				return 0;
@@ -2142,6 +2469,8 @@ int PASCAL connect(SOCKET fd, const struct sockaddr *addr, int addrlen)
 			if(memcmp(ipxaddr->sa_nodenum, (unsigned char[]){ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, 6) == 0)
 			{
 				sock->flags &= ~IPX_CONNECTED;
+				update_socket_index(sock);
+				
 				unlock_sockets();
 				
 				return 0;
@@ -2168,6 +2497,8 @@ int PASCAL connect(SOCKET fd, const struct sockaddr *addr, int addrlen)
 			memcpy(&(sock->remote_addr), addr, sizeof(*ipxaddr));
 			sock->flags |= IPX_CONNECTED;
 			
+			update_socket_index(sock);
+			
 			unlock_sockets();
 			
 			return 0;
@@ -2199,11 +2530,15 @@ int PASCAL send(SOCKET fd, const char *buf, int len, int flags)
 				return -1;
 			}
 			
-			int ret = sendto(fd, buf, len, 0, (struct sockaddr*)&(sock->remote_addr), sizeof(struct sockaddr_ipx));
+			/* Copy the remote address rather than holding the lock
+			 * until sendto() returns.
+			*/
+			
+			struct sockaddr_ipx remote_addr = sock->remote_addr;
 			
 			unlock_sockets();
 			
-			return ret;
+			return sendto(fd, buf, len, 0, (struct sockaddr*)(&remote_addr), sizeof(remote_addr));
 		}
 	}
 	else{
@@ -2277,6 +2612,8 @@ int PASCAL listen(SOCKET s, int backlog)
 			
 			sock->flags |= IPX_LISTENING;
 			
+			update_socket_index(sock);
+			
 			unlock_sockets();
 			
 			return 0;
@@ -2386,7 +2723,13 @@ SOCKET PASCAL accept(SOCKET s, struct sockaddr *addr, int *addrlen)
 			memcpy(nsock->remote_addr.sa_nodenum, spxinit.node, 6);
 			nsock->remote_addr.sa_socket = spxinit.socket;
 			
-			HASH_ADD_INT(sockets, fd, nsock);
+			nsock->stats = NULL;
+			nsock->ring  = NULL;
+			
+			nsock->index_list   = NULL;
+			nsock->index_bucket = NULL;
+			
+			add_socket(nsock);
 			
 			if(addr)
 			{
@@ -0,0 +1,89 @@
+# IPXWrapper test suite
+# Copyright (C) 2026 agent <agent@local>
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License version 2 as published by
+# the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+# more details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program; if not, write to the Free Software Foundation, Inc., 51
+# Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+use strict;
+use warnings;
+
+use Test::Spec;
+
+use FindBin;
+use lib "$FindBin::Bin/lib/";
+
+use IPXWrapper::Util;
+
+require "$FindBin::Bin/config.pm";
+
+our ($remote_mac_a, $remote_ip_a);
+
+
+use constant {
+	THREADS      => 4,
+	PACKETS      => 2000,
+	PAYLOAD_SIZE => 64,
+};
+
+sub send_threads
+{
+	my ($threads) = @_;
+
+	my $output = run_remote_cmd(
+		$remote_ip_a, "Z:\\tools\\ipx-send-threads.exe",
+		$threads, PACKETS, PAYLOAD_SIZE,
+	);
+
+	my %result = ($output =~ m/^(\w+): (\d+)$/mg);
+
+	note("$threads thread(s): $result{retries} retries, router received $result{router_rx}");
+
+	return \%result;
+}
+
+describe "IPXWrapper using IP encapsulation" => sub
+{
+	before all => sub
+	{
+		reg_delete_key($remote_ip_a, "HKCU\\Software\\IPXWrapper");
+		reg_set_addr(  $remote_ip_a, "HKCU\\Software\\IPXWrapper\\00:00:00:00:00:00", "net", "00:00:00:01");
+	};
+
+	describe "sending from several threads" => sub
+	{
+		my $result;
+
+		before all => sub
+		{
+			$result = send_threads(THREADS);
+		};
+
+		it "sends every packet without errors" => sub
+		{
+			is($result->{errors}, 0);
+			is($result->{sent},   THREADS * PACKETS);
+		};
+
+		it "keeps the router receiving while the threads send" => sub
+		{
+			cmp_ok($result->{router_rx}, ">", 0);
+		};
+
+		it "keeps delivering packets to every sending socket" => sub
+		{
+			is($result->{echoed}, THREADS);
+		};
+	};
+};
+
+runtests unless caller;
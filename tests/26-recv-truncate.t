@@ -0,0 +1,92 @@
+# IPXWrapper test suite
+# Copyright (C) 2026 agent <agent@local>
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License version 2 as published by
+# the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+# more details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program; if not, write to the Free Software Foundation, Inc., 51
+# Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+use strict;
+use warnings;
+
+use Test::Spec;
+
+use FindBin;
+use lib "$FindBin::Bin/lib/";
+
+use IPXWrapper::Util;
+
+require "$FindBin::Bin/config.pm";
+
+our ($remote_mac_a, $remote_ip_a);
+
+sub truncate_tests
+{
+	my $output;
+	
+	before all => sub
+	{
+		$output = run_remote_cmd($remote_ip_a, "Z:\\tools\\ipx-recv-trunc.exe", 100);
+	};
+	
+	it "reports the full size from ioctlsocket(FIONREAD)" => sub
+	{
+		like($output, qr/^fionread: 100$/m);
+	};
+	
+	it "fails recvfrom(MSG_PEEK) with WSAEMSGSIZE" => sub
+	{
+		like($output, qr/^peek: -1 10040 ok$/m);
+	};
+	
+	it "fails recvfrom() with WSAEMSGSIZE" => sub
+	{
+		like($output, qr/^recvfrom: -1 10040 ok$/m);
+	};
+	
+	it "returns a partial packet from WSARecvEx()" => sub
+	{
+		like($output, qr/^recvex: 10 MSG_PARTIAL ok$/m);
+	};
+	
+	it "receives a packet which fits" => sub
+	{
+		like($output, qr/^full: 100 ok$/m);
+	};
+}
+
+describe "IPXWrapper using IP encapsulation" => sub
+{
+	describe "receiving a packet too large for the buffer" => sub
+	{
+		before all => sub
+		{
+			reg_delete_key($remote_ip_a, "HKCU\\Software\\IPXWrapper");
+			reg_set_addr(  $remote_ip_a, "HKCU\\Software\\IPXWrapper\\00:00:00:00:00:00", "net", "00:00:00:01");
+		};
+		
+		truncate_tests();
+	};
+	
+	describe "receiving a packet too large for the buffer with ring delivery" => sub
+	{
+		before all => sub
+		{
+			reg_delete_key($remote_ip_a, "HKCU\\Software\\IPXWrapper");
+			reg_set_addr(  $remote_ip_a, "HKCU\\Software\\IPXWrapper\\00:00:00:00:00:00", "net", "00:00:00:01");
+			reg_set_dword( $remote_ip_a, "HKCU\\Software\\IPXWrapper", "ring_delivery", 1);
+		};
+		
+		truncate_tests();
+	};
+};
+
+runtests unless caller;
@@ -0,0 +1,127 @@
+# IPXWrapper test suite
+# Copyright (C) 2026 agent <agent@local>
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License version 2 as published by
+# the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+# more details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program; if not, write to the Free Software Foundation, Inc., 51
+# Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+use strict;
+use warnings;
+
+use Test::Spec;
+
+use FindBin;
+use lib "$FindBin::Bin/lib/";
+
+use IPXWrapper::Capture::IPXOverUDP;
+use IPXWrapper::Tool::IPXISR;
+use IPXWrapper::Util;
+
+require "$FindBin::Bin/config.pm";
+
+our ($local_dev_a, $local_mac_a, $local_ip_a);
+our ($remote_mac_a, $remote_ip_a);
+our ($net_a_bcast);
+
+use constant {
+	UDP_BCAST_PORT => 54792,
+	
+	# Long enough for the router thread to save the address cache at
+	# least once (see ADDR_CACHE_SAVE_INTERVAL).
+	SAVE_WAIT_SECS => 12,
+};
+
+describe "IPXWrapper using IP encapsulation" => sub
+{
+	before all => sub
+	{
+		reg_delete_key($remote_ip_a, "HKCU\\Software\\IPXWrapper");
+		reg_set_addr(  $remote_ip_a, "HKCU\\Software\\IPXWrapper\\00:00:00:00:00:00", "net", "00:00:00:01");
+		reg_set_addr(  $remote_ip_a, "HKCU\\Software\\IPXWrapper\\$remote_mac_a", "net", "00:00:00:01");
+		reg_set_dword( $remote_ip_a, "HKCU\\Software\\IPXWrapper", "persist_addr_cache", 1);
+	};
+	
+	describe "packets sent to an address cached by an earlier process" => sub
+	{
+		my @packets_a;
+		
+		before all => sub
+		{
+			{
+				my $listener = IPXWrapper::Tool::IPXISR->new($remote_ip_a,
+					"00:00:00:01", $remote_mac_a, "7777");
+				
+				# Let the first process learn our address, then
+				# exit normally once it has had time to save it.
+				
+				send_ipx_over_udp(
+					dest_ip   => $net_a_bcast,
+					dest_port => UDP_BCAST_PORT,
+					src_ip    => $local_ip_a,
+					src_port  => 6666,
+					
+					type => 0,
+					
+					dest_network => "00:00:00:01",
+					dest_node    => "FF:FF:FF:FF:FF:FF",
+					dest_socket  => 7778,
+					
+					src_network => "00:00:00:01",
+					src_node    => $local_mac_a,
+					src_socket  => 8888,
+					
+					data => "",
+				);
+				
+				sleep(SAVE_WAIT_SECS);
+				
+				$listener->kill_and_read();
+			}
+			
+			my $capture_a = IPXWrapper::Capture::IPXOverUDP->new($local_dev_a);
+			
+			run_remote_cmd(
+				$remote_ip_a, "Z:\\tools\\ipx-send.exe",
+				"-d" => "palimpsest",
+				"-s" => "5555", "-h" => $remote_mac_a,
+				"00:00:00:01", $local_mac_a, "8888",
+			);
+			
+			sleep(1);
+			
+			@packets_a = $capture_a->read_available();
+		};
+		
+		they "are unicast from the first packet" => sub
+		{
+			cmp_hashes_partial(\@packets_a, [
+				{
+					src_ip   => $remote_ip_a,
+					dst_ip   => $local_ip_a,
+					dst_port => 6666,
+					
+					dst_network => "00:00:00:01",
+					dst_node    => $local_mac_a,
+					dst_socket  => 8888,
+					
+					src_network => "00:00:00:01",
+					src_node    => $remote_mac_a,
+					src_socket  => 5555,
+					
+					data => "palimpsest",
+				},
+			]);
+		};
+	};
+};
+
+runtests unless caller;
@@ -0,0 +1,243 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* Contention test/benchmark for the address cache.
+ *
+ * A writer thread continually updates a set of cache entries the same way the
+ * router thread does, cycling each address through more values than an entry
+ * has endpoints and also rewriting unchanged addresses, while several reader
+ * threads look them up. Every address returned to a reader must be one of the
+ * values, never a mixture of them.
+ *
+ * The lookup and update rates are reported as diagnostics.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "src/addr.h"
+#include "src/addrcache.h"
+#include "src/common.h"
+#include "tests/tap/basic.h"
+
+#define N_READERS  4
+#define N_HOSTS    256
+#define RUN_MS     2000
+
+/* One more than ADDR_CACHE_ENDPOINTS, so every change replaces an endpoint. */
+#define N_PATTERNS (ADDR_CACHE_ENDPOINTS + 1)
+#define PATTERN(n) (0x11 * ((n) + 1))
+
+#define IFACE_A_NET  addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x0A})
+#define IFACE_A_NODE addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x0A})
+
+/* Need to implement log_printf() and w32_error() for addrcache.c */
+
+void log_printf(enum ipx_log_level level, const char *fmt, ...)
+{
+	va_list argv;
+	
+	va_start(argv, fmt);
+	vfprintf(stderr, fmt, argv);
+	va_end(argv);
+	
+	fprintf(stderr, "\n");
+}
+
+const char *w32_error(DWORD errnum) {
+	static char buf[1024] = {'\0'};
+	
+	FormatMessage(FORMAT_MESSAGE_FROM_SYSTEM, NULL, errnum, 0, buf, 1023, NULL);
+	buf[strcspn(buf, "\r\n")] = '\0';
+	return buf;
+}
+
+static volatile int running = 1;
+
+struct thread_result
+{
+	unsigned long long ops;
+	unsigned long long misses;
+	unsigned long long torn;
+};
+
+static addr48_t host_node(unsigned int i)
+{
+	return addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, (i >> 8), (i & 0xFF)});
+}
+
+static void set_host(unsigned int i, unsigned char pattern)
+{
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	
+	addr.sin_family = AF_INET;
+	memset(&(addr.sin_addr), pattern, sizeof(addr.sin_addr));
+	memset(&(addr.sin_port), pattern, sizeof(addr.sin_port));
+	
+	addr_cache_set((struct sockaddr*)(&addr), sizeof(addr),
+		addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+		host_node(i),
+		1,
+		IFACE_A_NET, IFACE_A_NODE);
+}
+
+static DWORD WINAPI writer_main(LPVOID arg)
+{
+	struct thread_result *result = arg;
+	unsigned int pass = 0;
+	
+	while(running)
+	{
+		/* Each address is written twice with the same value before it
+		 * is changed, so half of the updates are unchanged writes.
+		*/
+		
+		unsigned char pattern = PATTERN((pass++ / 2) % N_PATTERNS);
+		
+		for(unsigned int i = 0; i < N_HOSTS; ++i)
+		{
+			set_host(i, pattern);
+			++(result->ops);
+		}
+		
+		addr_cache_tick();
+	}
+	
+	return 0;
+}
+
+static DWORD WINAPI reader_main(LPVOID arg)
+{
+	struct thread_result *result = arg;
+	unsigned int i = 0;
+	
+	while(running)
+	{
+		i = (i * 1103515245 + 12345) % N_HOSTS;
+		
+		SOCKADDR_STORAGE addr;
+		size_t addrlen;
+		
+		if(!addr_cache_get(&addr, &addrlen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			host_node(i),
+			1,
+			IFACE_A_NET, IFACE_A_NODE))
+		{
+			++(result->misses);
+		}
+		else if(addrlen != sizeof(struct sockaddr_in))
+		{
+			++(result->torn);
+		}
+		else{
+			/* The address and port must both come from the same
+			 * update.
+			*/
+			
+			const struct sockaddr_in *sin = (const struct sockaddr_in*)(&addr);
+			
+			const unsigned char *p = (const unsigned char*)(&(sin->sin_addr));
+			const unsigned char *port = (const unsigned char*)(&(sin->sin_port));
+			
+			if(sin->sin_family != AF_INET
+				|| p[0] == 0 || (p[0] % PATTERN(0)) != 0 || p[0] > PATTERN(N_PATTERNS - 1)
+				|| p[1] != p[0] || p[2] != p[0] || p[3] != p[0]
+				|| port[0] != p[0] || port[1] != p[0])
+			{
+				++(result->torn);
+			}
+		}
+		
+		++(result->ops);
+	}
+	
+	return 0;
+}
+
+int main()
+{
+	plan_lazy();
+	
+	addr_cache_init();
+	
+	for(unsigned int i = 0; i < N_HOSTS; ++i)
+	{
+		set_host(i, PATTERN(0));
+	}
+	
+	struct thread_result writer_result;
+	struct thread_result reader_results[N_READERS];
+	
+	memset(&writer_result, 0, sizeof(writer_result));
+	memset(reader_results, 0, sizeof(reader_results));
+	
+	HANDLE threads[N_READERS + 1];
+	
+	threads[0] = CreateThread(NULL, 0, &writer_main, &writer_result, 0, NULL);
+	
+	for(int i = 0; i < N_READERS; ++i)
+	{
+		threads[i + 1] = CreateThread(NULL, 0, &reader_main, &reader_results[i], 0, NULL);
+	}
+	
+	for(int i = 0; i <= N_READERS; ++i)
+	{
+		if(threads[i] == NULL)
+		{
+			sysbail("CreateThread");
+		}
+	}
+	
+	Sleep(RUN_MS);
+	
+	running = 0;
+	WaitForMultipleObjects(N_READERS + 1, threads, TRUE, INFINITE);
+	
+	for(int i = 0; i <= N_READERS; ++i)
+	{
+		CloseHandle(threads[i]);
+	}
+	
+	unsigned long long reads = 0, misses = 0, torn = 0;
+	
+	for(int i = 0; i < N_READERS; ++i)
+	{
+		reads  += reader_results[i].ops;
+		misses += reader_results[i].misses;
+		torn   += reader_results[i].torn;
+	}
+	
+	is_int(0, misses, "addr_cache_get() finds every address while they are being updated");
+	is_int(0, torn, "addr_cache_get() never returns a partially updated address");
+	
+	ok(writer_result.ops > 0, "addr_cache_set() isn't blocked by readers");
+	
+	diag("%d readers: %.0f lookups/sec (%.0f per reader)",
+		N_READERS,
+		(double)(reads) * 1000 / RUN_MS,
+		(double)(reads) * 1000 / RUN_MS / N_READERS);
+	
+	diag("1 writer: %.0f updates/sec",
+		(double)(writer_result.ops) * 1000 / RUN_MS);
+	
+	addr_cache_cleanup();
+	
+	return 0;
+}
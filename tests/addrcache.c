@@ -24,7 +24,9 @@
 #include "src/common.h"
 #include "tests/tap/basic.h"
 
-/* Mock time() so we can test timing out of address cache records */
+/* Mock time() so we can test timing out of address cache records. The cache
+ * only reads the time when addr_cache_tick() is called.
+*/
 
 static time_t now = 0;
 
@@ -59,6 +61,68 @@ const char *w32_error(DWORD errnum) {
 	return buf;
 }
 
+#define SNAPSHOT_FILE "addrcache.tmp"
+
+/* Local interfaces addresses are seen on and sent from. */
+#define IFACE_A_NET  addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x0A})
+#define IFACE_A_NODE addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x0A})
+#define IFACE_B_NET  addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x0B})
+#define IFACE_B_NODE addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x0B})
+
+/* Fill in an IPv4 address made up of a repeated byte. */
+static void make_addr(struct sockaddr_in *addr, unsigned char pattern)
+{
+	memset(addr, 0, sizeof(*addr));
+	
+	addr->sin_family = AF_INET;
+	memset(&(addr->sin_addr), pattern, sizeof(addr->sin_addr));
+	memset(&(addr->sin_port), pattern, sizeof(addr->sin_port));
+}
+
+/* Cache an address for socket 1 on network 1, node 1. */
+static void set_multihomed(const struct sockaddr_in *addr, uint16_t sock, addr32_t iface_net, addr48_t iface_node)
+{
+	addr_cache_set((struct sockaddr*)(addr), sizeof(*addr),
+		addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+		addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+		sock,
+		iface_net, iface_node);
+}
+
+/* Look up the address of socket 1 on network 1, node 1. Returns the first byte
+ * of the IP address, or zero if none was found.
+*/
+static unsigned char get_multihomed(addr32_t iface_net, addr48_t iface_node)
+{
+	SOCKADDR_STORAGE addr;
+	size_t addrlen;
+	
+	if(!addr_cache_get(&addr, &addrlen,
+		addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+		addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+		1,
+		iface_net, iface_node))
+	{
+		return 0;
+	}
+	
+	return ((unsigned char*)(&(((struct sockaddr_in*)(&addr))->sin_addr)))[0];
+}
+
+static void fail_multihomed(const struct sockaddr_in *addr)
+{
+	addr_cache_send_failed((struct sockaddr*)(addr), sizeof(*addr),
+		addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+		addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+		1);
+}
+
+/* Rejects every address on network 2 when restoring a snapshot. */
+static bool reject_net_2(addr32_t net, addr48_t node, const struct sockaddr_in *addr, addr32_t iface_net, addr48_t iface_node)
+{
+	return net != addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x02});
+}
+
 int main()
 {
 	plan_lazy();
@@ -72,7 +136,8 @@ int main()
 		ok(!addr_cache_get(&addr, &addrlen,
 			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
 			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
-			1),
+			1,
+			IFACE_A_NET, IFACE_A_NODE),
 			"addr_cache_get() returns false when no addresses are known");
 		
 		addr_cache_cleanup();
@@ -82,12 +147,13 @@ int main()
 		addr_cache_init();
 		
 		struct sockaddr_in addr_in;
-		memset(&addr_in, 0xAB, sizeof(addr_in));
+		make_addr(&addr_in, 0xAB);
 		
 		addr_cache_set((struct sockaddr*)(&addr_in), sizeof(addr_in),
 			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
 			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
-			1);
+			1,
+			IFACE_A_NET, IFACE_A_NODE);
 		
 		SOCKADDR_STORAGE addr_out;
 		size_t aolen;
@@ -95,7 +161,8 @@ int main()
 		if(ok(addr_cache_get(&addr_out, &aolen,
 			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
 			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
-			1),
+			1,
+			IFACE_A_NET, IFACE_A_NODE),
 			"addr_cache_get() returns true when address is known"))
 		{
 			is_int(sizeof(addr_in), aolen, "addr_cache_get() returns correct address length");
@@ -109,22 +176,25 @@ int main()
 		addr_cache_init();
 		
 		struct sockaddr_in addr_in;
-		memset(&addr_in, 0xAB, sizeof(addr_in));
+		make_addr(&addr_in, 0xAB);
 		
 		addr_cache_set((struct sockaddr*)(&addr_in), sizeof(addr_in),
 			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
 			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
-			1);
+			1,
+			IFACE_A_NET, IFACE_A_NODE);
 		
 		SOCKADDR_STORAGE addr_out;
 		size_t aolen;
 		
 		now += 29;
+		addr_cache_tick();
 		
 		if(ok(addr_cache_get(&addr_out, &aolen,
 			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
 			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
-			1),
+			1,
+			IFACE_A_NET, IFACE_A_NODE),
 			"addr_cache_get() returns true when address is about to expire"))
 		{
 			is_int(sizeof(addr_in), aolen, "addr_cache_get() returns correct address length");
@@ -132,11 +202,13 @@ int main()
 		}
 		
 		now += 1;
+		addr_cache_tick();
 		
 		ok(!addr_cache_get(&addr_out, &aolen,
 			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
 			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
-			1),
+			1,
+			IFACE_A_NET, IFACE_A_NODE),
 			"addr_cache_get() returns false when address has expired");
 		
 		addr_cache_cleanup();
@@ -146,12 +218,86 @@ int main()
 		addr_cache_init();
 		
 		struct sockaddr_in addr_in;
-		memset(&addr_in, 0xAB, sizeof(addr_in));
+		make_addr(&addr_in, 0xAB);
+		
+		addr_cache_set((struct sockaddr*)(&addr_in), sizeof(addr_in),
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		SOCKADDR_STORAGE addr_out;
+		size_t aolen;
+		
+		now += 60;
+		
+		ok(addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_get() doesn't expire addresses until the clock ticks");
+		
+		addr_cache_tick();
+		
+		ok(!addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_get() expires addresses once the clock ticks");
+		
+		addr_cache_cleanup();
+	}
+	
+	{
+		addr_cache_init();
+		
+		struct sockaddr_in addr_in;
+		make_addr(&addr_in, 0xAB);
+		
+		addr_cache_set((struct sockaddr*)(&addr_in), sizeof(addr_in),
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		struct sockaddr_in addr_in2;
+		make_addr(&addr_in2, 0xCD);
+		
+		addr_cache_set((struct sockaddr*)(&addr_in2), sizeof(addr_in2),
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		SOCKADDR_STORAGE addr_out;
+		size_t aolen;
+		
+		if(ok(addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_get() returns true when address has been replaced"))
+		{
+			is_blob(&addr_in2, &addr_out, sizeof(addr_in2), "addr_cache_get() returns the replacement address data");
+		}
+		
+		addr_cache_cleanup();
+	}
+	
+	{
+		addr_cache_init();
+		
+		struct sockaddr_in addr_in;
+		make_addr(&addr_in, 0xAB);
 		
 		addr_cache_set((struct sockaddr*)(&addr_in), sizeof(addr_in),
 			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
 			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
-			1);
+			1,
+			IFACE_A_NET, IFACE_A_NODE);
 		
 		SOCKADDR_STORAGE addr_out;
 		size_t aolen;
@@ -159,7 +305,8 @@ int main()
 		ok(!addr_cache_get(&addr_out, &aolen,
 			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x02}),
 			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
-			1),
+			1,
+			IFACE_A_NET, IFACE_A_NODE),
 			"addr_cache_get() returns false when network number differs");
 		
 		addr_cache_cleanup();
@@ -169,12 +316,13 @@ int main()
 		addr_cache_init();
 		
 		struct sockaddr_in addr_in;
-		memset(&addr_in, 0xAB, sizeof(addr_in));
+		make_addr(&addr_in, 0xAB);
 		
 		addr_cache_set((struct sockaddr*)(&addr_in), sizeof(addr_in),
 			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
 			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
-			1);
+			1,
+			IFACE_A_NET, IFACE_A_NODE);
 		
 		SOCKADDR_STORAGE addr_out;
 		size_t aolen;
@@ -182,7 +330,8 @@ int main()
 		ok(!addr_cache_get(&addr_out, &aolen,
 			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
 			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x02}),
-			1),
+			1,
+			IFACE_A_NET, IFACE_A_NODE),
 			"addr_cache_get() returns false when node number differs");
 		
 		addr_cache_cleanup();
@@ -192,12 +341,13 @@ int main()
 		addr_cache_init();
 		
 		struct sockaddr_in addr_in;
-		memset(&addr_in, 0xAB, sizeof(addr_in));
+		make_addr(&addr_in, 0xAB);
 		
 		addr_cache_set((struct sockaddr*)(&addr_in), sizeof(addr_in),
 			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
 			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
-			1);
+			1,
+			IFACE_A_NET, IFACE_A_NODE);
 		
 		SOCKADDR_STORAGE addr_out;
 		size_t aolen;
@@ -205,11 +355,739 @@ int main()
 		ok(!addr_cache_get(&addr_out, &aolen,
 			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
 			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
-			2),
+			2,
+			IFACE_A_NET, IFACE_A_NODE),
 			"addr_cache_get() returns false when socket number differs");
 		
 		addr_cache_cleanup();
 	}
 	
+	{
+		addr_cache_init();
+		
+		struct sockaddr_in addr_in;
+		make_addr(&addr_in, 0xAB);
+		
+		for(unsigned int i = 0; i < ADDR_CACHE_MAX_ENTRIES; ++i)
+		{
+			addr_cache_set((struct sockaddr*)(&addr_in), sizeof(addr_in),
+				addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+				addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, (i >> 8), (i & 0xFF)}),
+				1,
+				IFACE_A_NET, IFACE_A_NODE);
+		}
+		
+		SOCKADDR_STORAGE addr_out;
+		size_t aolen;
+		
+		/* Use the oldest entry so it gets a second chance. */
+		
+		addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x00}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		addr_cache_set((struct sockaddr*)(&addr_in), sizeof(addr_in),
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x02}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x00}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		struct addr_cache_stats stats;
+		addr_cache_get_stats(&stats);
+		
+		is_int(ADDR_CACHE_MAX_ENTRIES, stats.entries, "addr_cache_set() doesn't grow the cache past ADDR_CACHE_MAX_ENTRIES");
+		is_int(1, stats.evictions, "addr_cache_set() evicts one entry when the cache is full");
+		
+		ok(addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x00}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_set() doesn't evict recently used entries");
+		
+		ok(!addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_set() evicts the least recently used entry");
+		
+		ok(addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x02}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x00}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_get() returns true for the new entry");
+		
+		unsigned int found = 0;
+		
+		for(unsigned int i = 0; i < ADDR_CACHE_MAX_ENTRIES; ++i)
+		{
+			found += addr_cache_get(&addr_out, &aolen,
+				addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+				addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, (i >> 8), (i & 0xFF)}),
+				1,
+				IFACE_A_NET, IFACE_A_NODE);
+		}
+		
+		is_int(ADDR_CACHE_MAX_ENTRIES - 1, found, "addr_cache_get() finds every entry left after an eviction");
+		
+		addr_cache_cleanup();
+	}
+	
+	{
+		addr_cache_init();
+		
+		struct sockaddr_in addr_in;
+		make_addr(&addr_in, 0xAB);
+		
+		addr_cache_set((struct sockaddr*)(&addr_in), sizeof(addr_in),
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		addr_cache_set((struct sockaddr*)(&addr_in), sizeof(addr_in),
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x02}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		now += 30;
+		addr_cache_tick();
+		
+		addr_cache_set((struct sockaddr*)(&addr_in), sizeof(addr_in),
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x03}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		struct addr_cache_stats stats;
+		addr_cache_get_stats(&stats);
+		
+		is_int(1, stats.entries, "addr_cache_set() removes expired entries");
+		is_int(2, stats.expired, "addr_cache_set() counts removed expired entries");
+		is_int(0, stats.evictions, "addr_cache_set() doesn't count expired entries as evictions");
+		
+		addr_cache_cleanup();
+	}
+	
+	{
+		addr_cache_init();
+		
+		struct sockaddr_in host_in, sock_in;
+		make_addr(&host_in, 0xAB);
+		make_addr(&sock_in, 0xCD);
+		
+		addr_cache_set((struct sockaddr*)(&host_in), sizeof(host_in),
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			0,
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		SOCKADDR_STORAGE addr_out;
+		size_t aolen;
+		
+		if(ok(addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_get() falls back to the host default"))
+		{
+			is_blob(&host_in, &addr_out, sizeof(host_in), "addr_cache_get() returns the host default address");
+		}
+		
+		ok(!addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x02}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_get() doesn't use the default of a different host");
+		
+		addr_cache_set((struct sockaddr*)(&sock_in), sizeof(sock_in),
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		if(ok(addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_get() returns true when both socket and host addresses are known"))
+		{
+			is_blob(&sock_in, &addr_out, sizeof(sock_in), "addr_cache_get() prefers the socket address");
+		}
+		
+		addr_cache_cleanup();
+	}
+	
+	{
+		addr_cache_init();
+		
+		/* Two processes on the same host, with the same IP address but
+		 * different ports.
+		*/
+		
+		struct sockaddr_in addr_a, addr_b;
+		make_addr(&addr_a, 0xAB);
+		make_addr(&addr_b, 0xCD);
+		
+		addr_b.sin_addr = addr_a.sin_addr;
+		
+		addr_cache_set((struct sockaddr*)(&addr_a), sizeof(addr_a),
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			0,
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		addr_cache_set((struct sockaddr*)(&addr_b), sizeof(addr_b),
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			0,
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		SOCKADDR_STORAGE addr_out;
+		size_t aolen;
+		
+		ok(!addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_get() doesn't fall back to an ambiguous host default");
+		
+		/* Keep the entry fresh without conflicting. */
+		
+		now += 20;
+		addr_cache_tick();
+		
+		addr_cache_set((struct sockaddr*)(&addr_b), sizeof(addr_b),
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			0,
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		ok(!addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_get() doesn't fall back to a host default within 30 seconds of a conflict");
+		
+		now += 10;
+		addr_cache_tick();
+		
+		addr_cache_set((struct sockaddr*)(&addr_b), sizeof(addr_b),
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			0,
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		if(ok(addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_get() falls back to a host default 30 seconds after a conflict"))
+		{
+			is_blob(&addr_b, &addr_out, sizeof(addr_b), "addr_cache_get() returns the latest host default address");
+		}
+		
+		addr_cache_cleanup();
+	}
+	
+	{
+		addr_cache_init();
+		
+		/* A host default which has gone stale and comes back on another
+		 * port, while the host is kept alive through another interface.
+		*/
+		
+		struct sockaddr_in addr_a, addr_b, addr_c;
+		make_addr(&addr_a, 0xAB);
+		make_addr(&addr_b, 0xCD);
+		make_addr(&addr_c, 0xEF);
+		
+		addr_b.sin_addr = addr_a.sin_addr;
+		
+		set_multihomed(&addr_a, 0, IFACE_A_NET, IFACE_A_NODE);
+		
+		now += 25;
+		addr_cache_tick();
+		
+		set_multihomed(&addr_c, 0, IFACE_B_NET, IFACE_B_NODE);
+		
+		now += 10;
+		addr_cache_tick();
+		
+		set_multihomed(&addr_b, 0, IFACE_A_NET, IFACE_A_NODE);
+		
+		SOCKADDR_STORAGE addr_out;
+		size_t aolen;
+		
+		if(ok(addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_get() doesn't treat a stale host default which changes port as ambiguous"))
+		{
+			is_blob(&addr_b, &addr_out, sizeof(addr_b), "addr_cache_get() returns the new port of a stale host default");
+		}
+		
+		addr_cache_cleanup();
+	}
+	
+	{
+		addr_cache_init();
+		
+		/* A host seen at a different IP address through each of two
+		 * interfaces.
+		*/
+		
+		struct sockaddr_in addr_a, addr_b;
+		make_addr(&addr_a, 0xAB);
+		make_addr(&addr_b, 0xCD);
+		
+		set_multihomed(&addr_a, 1, IFACE_A_NET, IFACE_A_NODE);
+		
+		now += 1;
+		addr_cache_tick();
+		
+		set_multihomed(&addr_b, 1, IFACE_B_NET, IFACE_B_NODE);
+		
+		is_int(0xAB, get_multihomed(IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_get() prefers the address seen on the sending interface");
+		is_int(0xCD, get_multihomed(IFACE_B_NET, IFACE_B_NODE),
+			"addr_cache_get() prefers the address seen on the sending interface when it is the newest");
+		is_int(0xCD, get_multihomed(0, 0),
+			"addr_cache_get() uses the most recently seen address when no interface matches");
+		
+		fail_multihomed(&addr_a);
+		
+		is_int(0xCD, get_multihomed(IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_get() moves on to another address after a send fails");
+		
+		fail_multihomed(&addr_b);
+		
+		is_int(0xAB, get_multihomed(IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_get() goes back to the sending interface once every address has failed");
+		
+		fail_multihomed(&addr_a);
+		
+		set_multihomed(&addr_a, 1, IFACE_A_NET, IFACE_A_NODE);
+		
+		is_int(0xAB, get_multihomed(IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_get() uses a failed address again once it is seen again");
+		
+		struct addr_cache_stats stats;
+		addr_cache_get_stats(&stats);
+		
+		is_int(1, stats.entries, "addr_cache_set() keeps every address of a host in one entry");
+		is_int(3, stats.send_failures, "addr_cache_send_failed() counts failures");
+		
+		/* Let the address on the first interface expire. */
+		
+		now += 25;
+		addr_cache_tick();
+		
+		set_multihomed(&addr_b, 1, IFACE_B_NET, IFACE_B_NODE);
+		
+		now += 10;
+		addr_cache_tick();
+		
+		is_int(0xCD, get_multihomed(IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_get() doesn't use an expired address seen on the sending interface");
+		
+		addr_cache_cleanup();
+	}
+	
+	{
+		addr_cache_init();
+		
+		struct sockaddr_in addrs[ADDR_CACHE_ENDPOINTS + 1];
+		
+		for(int i = 0; i <= ADDR_CACHE_ENDPOINTS; ++i)
+		{
+			make_addr(&(addrs[i]), i + 1);
+			set_multihomed(&(addrs[i]), 1, IFACE_A_NET, IFACE_A_NODE);
+			
+			now += 1;
+			addr_cache_tick();
+		}
+		
+		struct {
+			struct addr_cache_file_header header;
+			struct addr_cache_entry entries[ADDR_CACHE_ENDPOINTS + 1];
+		} dump;
+		
+		memset(&dump, 0, sizeof(dump));
+		addr_cache_dump(&dump, sizeof(dump));
+		
+		bool found_first = false;
+		
+		for(uint32_t i = 0; i < dump.header.n_entries; ++i)
+		{
+			found_first = found_first || dump.entries[i].ipaddr == addrs[0].sin_addr.s_addr;
+		}
+		
+		is_int(ADDR_CACHE_ENDPOINTS, dump.header.n_entries, "addr_cache_set() keeps at most ADDR_CACHE_ENDPOINTS addresses for a host");
+		ok(!found_first, "addr_cache_set() replaces the least recently seen address");
+		
+		if(dump.header.n_entries > 0)
+		{
+			is_blob(((unsigned char[]){0x00, 0x00, 0x00, 0x0A}), dump.entries[0].iface_net, 4, "addr_cache_dump() writes the interface network number");
+			is_blob(((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x0A}), dump.entries[0].iface_node, 6, "addr_cache_dump() writes the interface node number");
+		}
+		
+		addr_cache_cleanup();
+	}
+	
+	{
+		addr_cache_init();
+		
+		/* The router port of a host with two interfaces. */
+		
+		struct sockaddr_in addr_a, addr_b;
+		make_addr(&addr_a, 0xAB);
+		make_addr(&addr_b, 0xCD);
+		
+		set_multihomed(&addr_a, 0, IFACE_A_NET, IFACE_A_NODE);
+		set_multihomed(&addr_b, 0, IFACE_B_NET, IFACE_B_NODE);
+		
+		is_int(0xCD, get_multihomed(IFACE_B_NET, IFACE_B_NODE),
+			"addr_cache_get() doesn't treat a host default seen at two IP addresses as ambiguous");
+		
+		addr_cache_cleanup();
+	}
+	
+	{
+		addr_cache_init();
+		
+		struct sockaddr_in addr_a, addr_b;
+		make_addr(&addr_a, 0xAB);
+		make_addr(&addr_b, 0xCD);
+		
+		SOCKADDR_STORAGE addr_out;
+		size_t aolen;
+		
+		addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			htons(1),
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		addr_cache_set((struct sockaddr*)(&addr_a), sizeof(addr_a),
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			htons(1),
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		addr_cache_set((struct sockaddr*)(&addr_a), sizeof(addr_a),
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			htons(1),
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		addr_cache_set((struct sockaddr*)(&addr_b), sizeof(addr_b),
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x02}),
+			0,
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			htons(1),
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x02}),
+			htons(1),
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		now += 30;
+		addr_cache_tick();
+		
+		addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			htons(1),
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		struct addr_cache_stats stats;
+		addr_cache_get_stats(&stats);
+		
+		is_int(2, stats.hits, "addr_cache_get() counts hits, including host defaults");
+		is_int(2, stats.misses, "addr_cache_get() counts misses");
+		is_int(1, stats.expired_misses, "addr_cache_get() counts misses due to expired addresses");
+		is_int(2, stats.inserts, "addr_cache_set() counts inserts");
+		is_int(1, stats.updates, "addr_cache_set() counts updates");
+		
+		struct {
+			struct addr_cache_file_header header;
+			struct addr_cache_entry entries[2];
+		} dump;
+		
+		is_int(sizeof(dump), addr_cache_dump(&dump, sizeof(dump.header) + sizeof(dump.entries[0])),
+			"addr_cache_dump() returns the size needed for every entry");
+		
+		is_int(1, dump.header.n_entries, "addr_cache_dump() only writes entries which fit");
+		
+		memset(&dump, 0, sizeof(dump));
+		addr_cache_dump(&dump, sizeof(dump));
+		
+		if(is_int(2, dump.header.n_entries, "addr_cache_dump() writes every entry"))
+		{
+			/* Entries are dumped in the order they were added. */
+			
+			const struct addr_cache_entry *e = &(dump.entries[0]);
+			
+			is_blob(((unsigned char[]){0x00, 0x00, 0x00, 0x01}), e->net, 4, "addr_cache_dump() writes the network number");
+			is_blob(((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}), e->node, 6, "addr_cache_dump() writes the node number");
+			is_blob(((unsigned char[]){0x00, 0x01}), e->socket, 2, "addr_cache_dump() writes the socket number");
+			is_int(addr_a.sin_addr.s_addr, e->ipaddr, "addr_cache_dump() writes the IP address");
+			is_int(addr_a.sin_port, e->port, "addr_cache_dump() writes the port");
+			is_int(30, e->age, "addr_cache_dump() writes the age");
+			is_int(ADDR_CACHE_ENTRY_EXPIRED, e->flags, "addr_cache_dump() flags expired entries");
+		}
+		
+		addr_cache_cleanup();
+	}
+	
+	{
+		addr_cache_init();
+		
+		SOCKADDR_STORAGE addr_in6;
+		memset(&addr_in6, 0, sizeof(addr_in6));
+		addr_in6.ss_family = AF_INET6;
+		
+		addr_cache_set((struct sockaddr*)(&addr_in6), sizeof(addr_in6),
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			htons(1),
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		SOCKADDR_STORAGE addr_out;
+		size_t aolen;
+		
+		ok(!addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			htons(1),
+			IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_set() doesn't cache non-IPv4 addresses");
+		
+		addr_cache_cleanup();
+	}
+	
+	{
+		addr_cache_init();
+		
+		struct sockaddr_in addr_a, addr_b;
+		make_addr(&addr_a, 0xAB);
+		make_addr(&addr_b, 0xCD);
+		
+		addr_cache_set((struct sockaddr*)(&addr_a), sizeof(addr_a),
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			htons(1),
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		addr_cache_set((struct sockaddr*)(&addr_a), sizeof(addr_a),
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x02}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x02}),
+			htons(1),
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		now += 20;
+		addr_cache_tick();
+		
+		addr_cache_set((struct sockaddr*)(&addr_b), sizeof(addr_b),
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x03}),
+			htons(1),
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		ok(addr_cache_save(SNAPSHOT_FILE), "addr_cache_save() returns true");
+		
+		addr_cache_cleanup();
+		
+		now += 5;
+		addr_cache_init();
+		
+		ok(addr_cache_load(SNAPSHOT_FILE, &reject_net_2), "addr_cache_load() returns true");
+		
+		SOCKADDR_STORAGE addr_out;
+		size_t aolen;
+		
+		ok(addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			htons(1),
+			IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_load() restores saved addresses");
+		
+		ok(!addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x02}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x02}),
+			htons(1),
+			IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_load() doesn't restore addresses rejected by the callback");
+		
+		if(ok(addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x03}),
+			htons(1),
+			IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_load() restores recently set addresses"))
+		{
+			is_int(sizeof(addr_b), aolen, "addr_cache_get() returns correct length of a restored address");
+			is_blob(&addr_b, &addr_out, sizeof(addr_b), "addr_cache_get() returns correct data of a restored address");
+		}
+		
+		/* The first address was 25 seconds old when restored, the
+		 * other was only 5 seconds old so should have been given half
+		 * of the TTL.
+		*/
+		
+		now += 4;
+		addr_cache_tick();
+		
+		ok(addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			htons(1),
+			IFACE_A_NET, IFACE_A_NODE),
+			"Restored addresses remain valid until their original TTL expires");
+		
+		now += 1;
+		addr_cache_tick();
+		
+		ok(!addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			htons(1),
+			IFACE_A_NET, IFACE_A_NODE),
+			"Restored addresses expire with their original TTL");
+		
+		now += 9;
+		addr_cache_tick();
+		
+		ok(addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x03}),
+			htons(1),
+			IFACE_A_NET, IFACE_A_NODE),
+			"Restored addresses remain valid for half of the TTL");
+		
+		now += 1;
+		addr_cache_tick();
+		
+		ok(!addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x03}),
+			htons(1),
+			IFACE_A_NET, IFACE_A_NODE),
+			"Restored addresses expire after half of the TTL");
+		
+		addr_cache_cleanup();
+		
+		/* Restore the same snapshot after the addresses in it have
+		 * expired.
+		*/
+		
+		now += 10;
+		addr_cache_init();
+		
+		addr_cache_load(SNAPSHOT_FILE, NULL);
+		
+		struct addr_cache_stats stats;
+		addr_cache_get_stats(&stats);
+		
+		is_int(0, stats.entries, "addr_cache_load() doesn't restore addresses which have since expired");
+		
+		addr_cache_cleanup();
+		
+		remove(SNAPSHOT_FILE);
+	}
+	
+	{
+		addr_cache_init();
+		
+		ok(!addr_cache_load(SNAPSHOT_FILE, NULL), "addr_cache_load() returns false when the file doesn't exist");
+		
+		struct addr_cache_file_header header;
+		memset(&header, 0, sizeof(header));
+		
+		header.magic      = ADDR_CACHE_FILE_MAGIC;
+		header.version    = ADDR_CACHE_FILE_VERSION + 1;
+		header.entry_size = sizeof(struct addr_cache_entry);
+		
+		FILE *fh = fopen(SNAPSHOT_FILE, "wb");
+		fwrite(&header, sizeof(header), 1, fh);
+		fclose(fh);
+		
+		ok(!addr_cache_load(SNAPSHOT_FILE, NULL), "addr_cache_load() rejects a snapshot with a different version");
+		
+		header.version   = ADDR_CACHE_FILE_VERSION;
+		header.n_entries = 1;
+		
+		fh = fopen(SNAPSHOT_FILE, "wb");
+		fwrite(&header, sizeof(header), 1, fh);
+		fclose(fh);
+		
+		ok(!addr_cache_load(SNAPSHOT_FILE, NULL), "addr_cache_load() rejects a truncated snapshot");
+		
+		addr_cache_cleanup();
+		
+		remove(SNAPSHOT_FILE);
+	}
+	
+	{
+		addr_cache_init();
+		addr_cache_set_ttl(60);
+		
+		struct sockaddr_in addr_in;
+		make_addr(&addr_in, 0xAB);
+		
+		addr_cache_set((struct sockaddr*)(&addr_in), sizeof(addr_in),
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE);
+		
+		SOCKADDR_STORAGE addr_out;
+		size_t aolen;
+		
+		now += 59;
+		addr_cache_tick();
+		
+		ok(addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_get() returns true until the TTL set by addr_cache_set_ttl() expires");
+		
+		now += 1;
+		addr_cache_tick();
+		
+		ok(!addr_cache_get(&addr_out, &aolen,
+			addr32_in((unsigned char[]){0x00, 0x00, 0x00, 0x01}),
+			addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x01}),
+			1,
+			IFACE_A_NET, IFACE_A_NODE),
+			"addr_cache_get() returns false once the TTL set by addr_cache_set_ttl() expires");
+		
+		addr_cache_cleanup();
+	}
+	
 	return 0;
 }
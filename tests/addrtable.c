@@ -0,0 +1,327 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* Tests for the shared address table. Each table is kept in a file which is
+ * mapped twice, standing in for two processes sharing it.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "src/addr.h"
+#include "src/addrtable.h"
+#include "tests/tap/basic.h"
+
+#define TABLE_FILE "addrtable.tmp"
+
+#define NET(n)  addr32_in((unsigned char[]){0x00, 0x00, 0x00, (n)})
+#define NODE(n) addr48_in((unsigned char[]){0x00, 0x00, 0x00, 0x00, 0x00, (n)})
+
+#ifdef _WIN32
+
+static void *map_table(const char *path, size_t size)
+{
+	HANDLE file = CreateFile(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE)
+	{
+		sysbail("CreateFile");
+	}
+	
+	HANDLE map = CreateFileMapping(file, NULL, PAGE_READWRITE, 0, size, NULL);
+	if(map == NULL)
+	{
+		sysbail("CreateFileMapping");
+	}
+	
+	void *mem = MapViewOfFile(map, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if(mem == NULL)
+	{
+		sysbail("MapViewOfFile");
+	}
+	
+	/* The view keeps the mapping and file open. */
+	
+	CloseHandle(map);
+	CloseHandle(file);
+	
+	return mem;
+}
+
+static void unmap_table(void *mem, size_t size)
+{
+	UnmapViewOfFile(mem);
+}
+
+#else
+
+static void *map_table(const char *path, size_t size)
+{
+	int fd = open(path, O_RDWR | O_CREAT, 0600);
+	if(fd == -1)
+	{
+		sysbail("open");
+	}
+	
+	if(ftruncate(fd, size) == -1)
+	{
+		sysbail("ftruncate");
+	}
+	
+	void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(mem == MAP_FAILED)
+	{
+		sysbail("mmap");
+	}
+	
+	close(fd);
+	
+	return mem;
+}
+
+static void unmap_table(void *mem, size_t size)
+{
+	munmap(mem, size);
+}
+
+#endif
+
+static void set_addr(addr_table_t *table, uint8_t node, unsigned char pattern, uint32_t now)
+{
+	unsigned char addr[16];
+	memset(addr, pattern, sizeof(addr));
+	
+	addr_table_set(table, NET(1), NODE(node), 0, addr, sizeof(addr), now, 30);
+}
+
+static bool get_addr(addr_table_t *table, uint8_t node, struct addr_table_value *value)
+{
+	return addr_table_get(table, NET(1), NODE(node), 0, value);
+}
+
+int main()
+{
+	plan_lazy();
+	
+	remove(TABLE_FILE);
+	
+	{
+		size_t size = addr_table_size(64);
+		
+		void *mem_a = map_table(TABLE_FILE, size);
+		void *mem_b = map_table(TABLE_FILE, size);
+		
+		addr_table_t table_a, table_b;
+		
+		ok(addr_table_attach(&table_a, mem_a, size), "addr_table_attach() initialises an empty table");
+		ok(addr_table_attach(&table_b, mem_b, size), "addr_table_attach() attaches to an existing table");
+		
+		struct addr_table_value value;
+		
+		ok(!get_addr(&table_b, 1, &value), "addr_table_get() returns false when no addresses are known");
+		
+		unsigned char addr[16];
+		memset(addr, 0xAB, sizeof(addr));
+		
+		ok(addr_table_set(&table_a, NET(1), NODE(1), 2, addr, sizeof(addr), 100, 30),
+			"addr_table_set() returns true");
+		
+		if(ok(addr_table_get(&table_b, NET(1), NODE(1), 2, &value),
+			"addr_table_get() finds an address set through another mapping"))
+		{
+			is_int(sizeof(addr), value.addrlen, "addr_table_get() returns correct address length");
+			is_blob(addr, value.addr, sizeof(addr), "addr_table_get() returns correct address data");
+			is_int(100, value.time, "addr_table_get() returns time address was set");
+			ok(!value.conflict, "addr_table_get() doesn't report a conflict for a new address");
+		}
+		
+		ok(!addr_table_get(&table_b, NET(1), NODE(1), 3, &value),
+			"addr_table_get() doesn't return the address of a different socket");
+		
+		unsigned int n_found = 0;
+		bool found_key = false;
+		
+		for(uint32_t i = 0; i < table_b.n_slots; ++i)
+		{
+			addr32_t net;
+			addr48_t node;
+			uint16_t sock;
+			
+			if(addr_table_get_slot(&table_b, i, &net, &node, &sock, &value))
+			{
+				++n_found;
+				found_key = (net == NET(1) && node == NODE(1) && sock == 2 && value.addr[0] == 0xAB);
+			}
+		}
+		
+		ok((n_found == 1 && found_key), "addr_table_get_slot() returns each address in the table");
+		
+		unsigned char big[ADDR_TABLE_ADDR_MAX + 1];
+		memset(big, 0, sizeof(big));
+		
+		ok(!addr_table_set(&table_a, NET(1), NODE(1), 2, big, sizeof(big), 100, 30),
+			"addr_table_set() rejects addresses larger than ADDR_TABLE_ADDR_MAX");
+		
+		unmap_table(mem_b, size);
+		unmap_table(mem_a, size);
+		
+		/* Map the file again, as a process starting after the others
+		 * had exited would.
+		*/
+		
+		mem_a = map_table(TABLE_FILE, size);
+		
+		ok((addr_table_attach(&table_a, mem_a, size)
+			&& addr_table_get(&table_a, NET(1), NODE(1), 2, &value)),
+			"Addresses persist in the table after it is unmapped");
+		
+		unmap_table(mem_a, size);
+		
+		mem_a = map_table(TABLE_FILE, addr_table_size(32));
+		
+		ok(!addr_table_attach(&table_a, mem_a, addr_table_size(32)),
+			"addr_table_attach() rejects a table of a different size");
+		
+		unmap_table(mem_a, addr_table_size(32));
+		
+		remove(TABLE_FILE);
+	}
+	
+	{
+		size_t size = addr_table_size(64);
+		
+		void *mem_a = map_table(TABLE_FILE, size);
+		void *mem_b = map_table(TABLE_FILE, size);
+		
+		addr_table_t table_a, table_b;
+		
+		addr_table_attach(&table_a, mem_a, size);
+		addr_table_attach(&table_b, mem_b, size);
+		
+		struct addr_table_value value;
+		
+		set_addr(&table_a, 1, 0xAB, 100);
+		set_addr(&table_b, 1, 0xAB, 110);
+		
+		ok((get_addr(&table_a, 1, &value) && !value.conflict && value.time == 110),
+			"addr_table_set() refreshes an unchanged address without a conflict");
+		
+		set_addr(&table_b, 1, 0xCD, 120);
+		
+		if(ok((get_addr(&table_a, 1, &value) && value.conflict),
+			"addr_table_set() records a conflict when a fresh address changes"))
+		{
+			is_int(120, value.conflict_time, "addr_table_get() returns time of the conflict");
+			is_int(0xCD, value.addr[0], "addr_table_get() returns the latest address");
+		}
+		
+		set_addr(&table_a, 2, 0xAB, 100);
+		set_addr(&table_a, 2, 0xCD, 130);
+		
+		ok((get_addr(&table_b, 2, &value) && !value.conflict && value.addr[0] == 0xCD),
+			"addr_table_set() doesn't record a conflict when an expired address changes");
+		
+		unmap_table(mem_b, size);
+		unmap_table(mem_a, size);
+		
+		remove(TABLE_FILE);
+	}
+	
+	{
+		/* With as many slots as the probe length, every key shares the
+		 * same probe sequence.
+		*/
+		
+		size_t size = addr_table_size(ADDR_TABLE_MAX_PROBE);
+		void *mem = map_table(TABLE_FILE, size);
+		
+		addr_table_t table;
+		addr_table_attach(&table, mem, size);
+		
+		struct addr_table_value value;
+		
+		for(int i = 0; i < ADDR_TABLE_MAX_PROBE; ++i)
+		{
+			set_addr(&table, i + 1, 0xAB, 100 + i);
+		}
+		
+		int found = 0;
+		
+		for(int i = 0; i < ADDR_TABLE_MAX_PROBE; ++i)
+		{
+			found += get_addr(&table, i + 1, &value);
+		}
+		
+		is_int(ADDR_TABLE_MAX_PROBE, found, "addr_table_get() finds every address in a full table");
+		
+		set_addr(&table, 100, 0xAB, 120);
+		
+		ok(get_addr(&table, 100, &value), "addr_table_set() makes room in a full table");
+		ok(!get_addr(&table, 1, &value), "addr_table_set() replaces the oldest address in a full table");
+		ok(get_addr(&table, 2, &value), "addr_table_set() only replaces one address");
+		
+		set_addr(&table, 101, 0xAB, 131);
+		
+		ok(get_addr(&table, 101, &value), "addr_table_set() reuses an expired slot");
+		ok(get_addr(&table, 100, &value), "addr_table_set() doesn't replace a fresh address when one has expired");
+		
+		/* Leave a slot claimed, as a process which died while writing
+		 * it would.
+		*/
+		
+		for(uint32_t i = 0; i < table.n_slots; ++i)
+		{
+			if(table.slots[i].used && table.slots[i].node == NODE(100))
+			{
+				++(table.slots[i].version);
+			}
+		}
+		
+		ok(!get_addr(&table, 100, &value), "addr_table_get() gives up on a slot which is never released");
+		
+		/* The slot was claimed at 120, so can be taken over once the
+		 * TTL has passed.
+		*/
+		
+		set_addr(&table, 100, 0xCD, 150);
+		
+		ok((get_addr(&table, 100, &value) && value.addr[0] == 0xCD),
+			"addr_table_set() takes over a slot left claimed for the TTL");
+		
+		int copies = 0;
+		
+		for(uint32_t i = 0; i < table.n_slots; ++i)
+		{
+			copies += (table.slots[i].used && table.slots[i].node == NODE(100));
+		}
+		
+		is_int(1, copies, "addr_table_set() doesn't write another copy of a key in a slot left claimed");
+		
+		unmap_table(mem, size);
+		
+		remove(TABLE_FILE);
+	}
+	
+	return 0;
+}
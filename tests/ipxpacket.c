@@ -0,0 +1,106 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <winsock2.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "tests/tap/basic.h"
+#include "src/ipxpacket.h"
+
+int main()
+{
+	plan_lazy();
+	
+	is_int(27, IPX_PACKET_HEADER_SIZE, "IPX_PACKET_HEADER_SIZE is 27");
+	
+	/* +------------------------+
+	 * | ipx_packet_header_pack |
+	 * +------------------------+
+	*/
+	
+	uint8_t ptype = 0x42;
+	
+	addr32_t src_net    = addr32_in((unsigned char[]){ 0xDE, 0xAD, 0xBE, 0xEF });
+	addr48_t src_node   = addr48_in((unsigned char[]){ 0x0B, 0xAD, 0x0B, 0xEE, 0xF0, 0x0D });
+	uint16_t src_socket = htons(1234);
+	
+	addr32_t dst_net    = addr32_in((unsigned char[]){ 0xBE, 0xEF, 0x0D, 0xAD });
+	addr48_t dst_node   = addr48_in((unsigned char[]){ 0x99, 0xB0, 0x77, 0x1E, 0x50, 0x00 });
+	uint16_t dst_socket = htons(9876);
+	
+	{
+		unsigned char buf[64];
+		memset(buf, 0xAA, sizeof(buf));
+		
+		ipx_packet_header_pack((ipx_packet*)(buf),
+			ptype,
+			src_net, src_node, src_socket,
+			dst_net, dst_node, dst_socket,
+			4);
+		
+		static const unsigned char expect[] = {
+			0x42,                               /* Type */
+			
+			0xBE, 0xEF, 0x0D, 0xAD,             /* Destination network */
+			0x99, 0xB0, 0x77, 0x1E, 0x50, 0x00, /* Destination node */
+			0x26, 0x94,                         /* Destination socket */
+			
+			0xDE, 0xAD, 0xBE, 0xEF,             /* Source network */
+			0x0B, 0xAD, 0x0B, 0xEE, 0xF0, 0x0D, /* Source node */
+			0x04, 0xD2,                         /* Source socket */
+			
+			0x00, 0x04,                         /* Payload size */
+			
+			/* Untouched */
+			0xAA, 0xAA, 0xAA, 0xAA,
+		};
+		
+		is_blob(expect, buf, sizeof(expect), "ipx_packet_header_pack() serialises correctly");
+	}
+	
+	{
+		unsigned char buf[IPX_PACKET_HEADER_SIZE];
+		
+		ipx_packet_header_pack((ipx_packet*)(buf),
+			ptype,
+			src_net, src_node, src_socket,
+			dst_net, dst_node, dst_socket,
+			8192);
+		
+		static const unsigned char expect[] = { 0x20, 0x00 };
+		
+		is_blob(expect, buf + 25, sizeof(expect), "ipx_packet_header_pack() stores the payload size in network byte order");
+	}
+	
+	{
+		unsigned char buf[IPX_PACKET_HEADER_SIZE];
+		
+		ipx_packet_header_pack((ipx_packet*)(buf),
+			ptype,
+			src_net, src_node, src_socket,
+			dst_net, dst_node, dst_socket,
+			0);
+		
+		static const unsigned char expect[] = { 0x00, 0x00 };
+		
+		is_blob(expect, buf + 25, sizeof(expect), "ipx_packet_header_pack() handles an empty payload");
+	}
+	
+	return 0;
+}
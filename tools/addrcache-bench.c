@@ -0,0 +1,273 @@
+/* IPXWrapper address cache benchmarking tool
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* Compares lookups in the address cache against the uthash table it used to
+ * be built on, which is reimplemented here. The cache is linked with room for
+ * the largest number of entries tested.
+ *
+ * Writes all results to stdout in a tab-seperated values format suitable for
+ * processing with gnuplot.
+ *
+ * The fields are:
+ *
+ *  1: implementation ("uthash" or "addrcache")
+ *  2: number of entries
+ *  3: mean insert time (ns)
+ *  4: mean lookup time for addresses in the table (ns)
+ *  5: mean lookup time for addresses not in the table (ns)
+*/
+
+#include <winsock2.h>
+#include <windows.h>
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <uthash.h>
+
+#include "addr.h"
+#include "addrcache.h"
+#include "common.h"
+
+#define NET 0x00000001
+
+static uint64_t PC_FREQUENCY;
+
+static uint64_t get_ticks_ns(void)
+{
+	LARGE_INTEGER pc;
+	QueryPerformanceCounter(&pc);
+	
+	return pc.QuadPart * ((double)(1000000000) / PC_FREQUENCY);
+}
+
+/* Need to implement log_printf() and w32_error() for addrcache.c */
+
+void log_printf(enum ipx_log_level level, const char *fmt, ...) {}
+
+const char *w32_error(DWORD errnum)
+{
+	return "";
+}
+
+/* The uthash table, as the address cache used to be. */
+
+struct uthash_key {
+	addr32_t netnum;
+	addr48_t nodenum;
+	uint16_t socket;
+} __attribute__((__packed__));
+
+struct uthash_entry {
+	struct uthash_key key;
+	
+	SOCKADDR_STORAGE addr;
+	size_t addrlen;
+	
+	time_t time;
+	
+	UT_hash_handle hh;
+};
+
+static struct uthash_entry *uthash_table = NULL;
+
+static void uthash_set(const struct sockaddr *addr, size_t addrlen, addr32_t net, addr48_t node, uint16_t sock)
+{
+	struct uthash_key key;
+	memset(&key, 0, sizeof(key));
+	
+	key.netnum  = net;
+	key.nodenum = node;
+	key.socket  = sock;
+	
+	struct uthash_entry *entry;
+	HASH_FIND(hh, uthash_table, &key, sizeof(key), entry);
+	
+	if(!entry)
+	{
+		entry = malloc(sizeof(*entry));
+		assert(entry != NULL);
+		
+		entry->key = key;
+		HASH_ADD(hh, uthash_table, key, sizeof(key), entry);
+	}
+	
+	memcpy(&(entry->addr), addr, addrlen);
+	entry->addrlen = addrlen;
+	entry->time    = time(NULL);
+}
+
+static int uthash_get(SOCKADDR_STORAGE *addr, size_t *addrlen, addr32_t net, addr48_t node, uint16_t sock)
+{
+	struct uthash_key key;
+	memset(&key, 0, sizeof(key));
+	
+	key.netnum  = net;
+	key.nodenum = node;
+	key.socket  = sock;
+	
+	struct uthash_entry *entry;
+	HASH_FIND(hh, uthash_table, &key, sizeof(key), entry);
+	
+	if(entry && entry->time + ADDR_CACHE_TTL > time(NULL))
+	{
+		memcpy(addr, &(entry->addr), entry->addrlen);
+		*addrlen = entry->addrlen;
+		
+		return 1;
+	}
+	
+	return 0;
+}
+
+static void uthash_clear(void)
+{
+	struct uthash_entry *entry, *tmp;
+	
+	HASH_ITER(hh, uthash_table, entry, tmp)
+	{
+		HASH_DEL(uthash_table, entry);
+		free(entry);
+	}
+}
+
+/* The address cache, with every address seen on and sent from the same
+ * interface.
+*/
+
+#define IFACE_NET  0x0000000A
+#define IFACE_NODE 0
+
+static void addrcache_set(const struct sockaddr *addr, size_t addrlen, addr32_t net, addr48_t node, uint16_t sock)
+{
+	addr_cache_set(addr, addrlen, net, node, sock, IFACE_NET, IFACE_NODE);
+}
+
+static int addrcache_get(SOCKADDR_STORAGE *addr, size_t *addrlen, addr32_t net, addr48_t node, uint16_t sock)
+{
+	return addr_cache_get(addr, addrlen, net, node, sock, IFACE_NET, IFACE_NODE);
+}
+
+static addr48_t bench_node(unsigned int i)
+{
+	return addr48_in((unsigned char[]){0x00, 0x00, (i >> 24), (i >> 16), (i >> 8), (i & 0xFF)});
+}
+
+static void run_test(const char *name,
+	void (*set_func)(const struct sockaddr*, size_t, addr32_t, addr48_t, uint16_t),
+	int (*get_func)(SOCKADDR_STORAGE*, size_t*, addr32_t, addr48_t, uint16_t),
+	unsigned int n_entries, unsigned int lookups)
+{
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	
+	addr.sin_family = AF_INET;
+	addr.sin_port   = htons(9999);
+	
+	uint64_t insert_start = get_ticks_ns();
+	
+	for(unsigned int i = 0; i < n_entries; ++i)
+	{
+		addr.sin_addr.s_addr = htonl(0x0A000000 | i);
+		set_func((struct sockaddr*)(&addr), sizeof(addr), NET, bench_node(i), 1);
+	}
+	
+	uint64_t insert_ns = get_ticks_ns() - insert_start;
+	
+	SOCKADDR_STORAGE addr_out;
+	size_t addrlen;
+	
+	unsigned int found = 0, i = 0;
+	
+	uint64_t hit_start = get_ticks_ns();
+	
+	for(unsigned int n = 0; n < lookups; ++n)
+	{
+		i = (i * 1103515245 + 12345) % n_entries;
+		found += get_func(&addr_out, &addrlen, NET, bench_node(i), 1);
+	}
+	
+	uint64_t hit_ns = get_ticks_ns() - hit_start;
+	
+	if(found != lookups)
+	{
+		fprintf(stderr, "%s: only found %u of %u addresses\n", name, found, lookups);
+		exit(1);
+	}
+	
+	found = 0;
+	
+	uint64_t miss_start = get_ticks_ns();
+	
+	for(unsigned int n = 0; n < lookups; ++n)
+	{
+		i = (i * 1103515245 + 12345) % n_entries;
+		found += get_func(&addr_out, &addrlen, NET, bench_node(i), 2);
+	}
+	
+	uint64_t miss_ns = get_ticks_ns() - miss_start;
+	
+	if(found != 0)
+	{
+		fprintf(stderr, "%s: found %u addresses which were never set\n", name, found);
+		exit(1);
+	}
+	
+	printf("%s\t%u\t%f\t%f\t%f\n",
+		name,
+		n_entries,
+		(double)(insert_ns) / n_entries,
+		(double)(hit_ns) / lookups,
+		(double)(miss_ns) / lookups);
+}
+
+int main(int argc, char **argv)
+{
+	if(argc != 2)
+	{
+		fprintf(stderr, "Usage: %s <lookup count>\n", argv[0]);
+		return 1;
+	}
+	
+	unsigned int lookups = strtoul(argv[1], NULL, 10);
+	
+	{
+		LARGE_INTEGER pc_freq;
+		QueryPerformanceFrequency(&pc_freq);
+		
+		PC_FREQUENCY = pc_freq.QuadPart;
+	}
+	
+	static const unsigned int SIZES[] = { 100, 10000, 1000000 };
+	
+	for(size_t s = 0; s < sizeof(SIZES) / sizeof(*SIZES); ++s)
+	{
+		assert(SIZES[s] <= ADDR_CACHE_MAX_ENTRIES);
+		
+		run_test("uthash", &uthash_set, &uthash_get, SIZES[s], lookups);
+		uthash_clear();
+		
+		addr_cache_init();
+		
+		run_test("addrcache", &addrcache_set, &addrcache_get, SIZES[s], lookups);
+		
+		addr_cache_cleanup();
+	}
+	
+	return 0;
+}
@@ -0,0 +1,165 @@
+/* IPXWrapper address cache inspection tool
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* Prints the address cache counters and every entry in the address cache,
+ * with a line for each address a host has been seen at.
+ *
+ * The cache belongs to the process, so unless shared_addr_cache is enabled
+ * this only shows what the tool's own router learns. Pass a number of seconds
+ * to listen on a bound socket for first, giving it time to hear announcements
+ * and traffic from other hosts. With shared_addr_cache enabled the entries are
+ * those learned by every process on the host.
+*/
+
+#include <winsock2.h>
+#include <windows.h>
+#include <wsipx.h>
+#include <wsnwlink.h>
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "addr.h"
+#include "addrcache.h"
+
+static void print_stats(int sock)
+{
+	struct addr_cache_stats stats;
+	int len = sizeof(stats);
+	
+	assert(getsockopt(sock, NSPROTO_IPX, IPXWRAPPER_ADDR_CACHE_STATS, (char*)(&stats), &len) == 0);
+	
+	uint64_t lookups = stats.hits + stats.misses;
+	
+	printf("entries         %" PRIu64 "\n", stats.entries);
+	printf("hits            %" PRIu64 "\n", stats.hits);
+	printf("misses          %" PRIu64 " (%.1f%% of lookups)\n", stats.misses,
+		lookups ? (double)(stats.misses) * 100 / lookups : 0.0);
+	printf("expired misses  %" PRIu64 "\n", stats.expired_misses);
+	printf("inserts         %" PRIu64 "\n", stats.inserts);
+	printf("updates         %" PRIu64 "\n", stats.updates);
+	printf("evictions       %" PRIu64 "\n", stats.evictions);
+	printf("expired         %" PRIu64 "\n", stats.expired);
+	printf("send failures   %" PRIu64 "\n", stats.send_failures);
+}
+
+static void print_entries(int sock)
+{
+	/* Ask for the size first, then retry until the buffer is big enough
+	 * for entries added in between.
+	*/
+	
+	struct addr_cache_file_header *dump = NULL;
+	int len = 0;
+	
+	while(1)
+	{
+		int size = len > (int)(sizeof(*dump)) ? len : (int)(sizeof(*dump));
+		
+		dump = realloc(dump, size);
+		assert(dump != NULL);
+		
+		len = size;
+		assert(getsockopt(sock, NSPROTO_IPX, IPXWRAPPER_ADDR_CACHE_DUMP, (char*)(dump), &len) == 0);
+		
+		if(len <= size)
+		{
+			break;
+		}
+	}
+	
+	assert(dump->magic == ADDR_CACHE_FILE_MAGIC);
+	assert(dump->entry_size == sizeof(struct addr_cache_entry));
+	
+	printf("\n%-11s  %-17s  %-6s  %-21s  %-5s  %-29s  %s\n", "Network", "Node", "Socket", "Address", "Age", "Interface", "Flags");
+	
+	const struct addr_cache_entry *entries = (const struct addr_cache_entry*)(dump + 1);
+	
+	for(uint32_t i = 0; i < dump->n_entries; ++i)
+	{
+		const struct addr_cache_entry *entry = &(entries[i]);
+		
+		char net[ADDR32_STRING_SIZE];
+		addr32_string(net, addr32_in(entry->net));
+		
+		char node[ADDR48_STRING_SIZE];
+		addr48_string(node, addr48_in(entry->node));
+		
+		uint16_t socket;
+		memcpy(&socket, entry->socket, sizeof(socket));
+		
+		struct in_addr ipaddr;
+		ipaddr.s_addr = entry->ipaddr;
+		
+		char addr[32];
+		snprintf(addr, sizeof(addr), "%s:%hu", inet_ntoa(ipaddr), ntohs(entry->port));
+		
+		char iface_net[ADDR32_STRING_SIZE];
+		addr32_string(iface_net, addr32_in(entry->iface_net));
+		
+		char iface_node[ADDR48_STRING_SIZE];
+		addr48_string(iface_node, addr48_in(entry->iface_node));
+		
+		printf("%-11s  %-17s  %-6hu  %-21s  %-5u  %s/%s  %s%s\n",
+			net, node, ntohs(socket), addr, (unsigned)(entry->age), iface_net, iface_node,
+			((entry->flags & ADDR_CACHE_ENTRY_EXPIRED)  ? "expired " : ""),
+			((entry->flags & ADDR_CACHE_ENTRY_CONFLICT) ? "ambiguous" : ""));
+	}
+	
+	free(dump);
+}
+
+int main(int argc, char **argv)
+{
+	if(argc > 2)
+	{
+		fprintf(stderr, "Usage: %s [<listen seconds>]\n", argv[0]);
+		return 1;
+	}
+	
+	unsigned int listen_secs = argc == 2 ? strtoul(argv[1], NULL, 10) : 0;
+	
+	{
+		WSADATA wsaData;
+		assert(WSAStartup(MAKEWORD(1,1), &wsaData) == 0);
+	}
+	
+	int sock = socket(AF_IPX, SOCK_DGRAM, NSPROTO_IPX);
+	assert(sock != -1);
+	
+	if(listen_secs > 0)
+	{
+		struct sockaddr_ipx addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sa_family = AF_IPX;
+		
+		assert(bind(sock, (struct sockaddr*)(&addr), sizeof(addr)) == 0);
+		
+		Sleep(listen_secs * 1000);
+	}
+	
+	print_stats(sock);
+	print_entries(sock);
+	
+	closesocket(sock);
+	
+	WSACleanup();
+	
+	return 0;
+}
@@ -34,6 +34,9 @@
  * 10: mean recv() call duration (µs)
  * 11: mean round trip time (µs)
  * 
+ * Payloads from 16 to 1024 bytes are tested, or up to 8192 bytes if "large" is
+ * given after the other arguments.
+ * 
  * The output will start with records containing fields 1-4 for each packet
  * sent, in order of payload size.
  * 
@@ -46,6 +49,7 @@
 #include <wsipx.h>
 #include <wsnwlink.h>
 #include <stdio.h>
+#include <stdbool.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
@@ -271,16 +275,17 @@ static void run_test(
 
 int main(int argc, char **argv)
 {
-	if(argc != 6)
+	if(argc != 6 && !(argc == 7 && strcmp(argv[6], "large") == 0))
 	{
 		fprintf(stderr, "Usage: %s <network number> <node number> <socket number> \\\n", argv[0]);
-		fprintf(stderr, "          <packet count> <min send interval (µs)>\n");
+		fprintf(stderr, "          <packet count> <min send interval (µs)> [large]\n");
 		return 1;
 	}
 	
 	struct sockaddr_ipx send_addr  = read_sockaddr(argv[1], argv[2], argv[3]);
 	unsigned int send_count        = strtoul(argv[4], NULL, 10);
 	unsigned int min_send_interval = strtoul(argv[5], NULL, 10);
+	bool sweep_large               = (argc == 7);
 	
 	{
 		LARGE_INTEGER pc_freq;
@@ -308,6 +313,17 @@ int main(int argc, char **argv)
 	run_test(sock, &send_addr, 512,  send_count, min_send_interval);
 	run_test(sock, &send_addr, 1024, send_count, min_send_interval);
 	
+	/* Payloads beyond the Ethernet MTU only work with IP encapsulation,
+	 * where the cost of copying the payload is most visible.
+	*/
+	
+	if(sweep_large)
+	{
+		run_test(sock, &send_addr, 2048, send_count, min_send_interval);
+		run_test(sock, &send_addr, 4096, send_count, min_send_interval);
+		run_test(sock, &send_addr, 8192, send_count, min_send_interval);
+	}
+	
 	printf("%s", deferred_output);
 	
 	closesocket(sock);
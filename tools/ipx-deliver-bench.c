@@ -0,0 +1,174 @@
+/* IPX(Wrapper) local delivery benchmarking tool
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* Measures the cost of delivering packets from the router to an application
+ * socket, for comparing loopback relaying with ring delivery. Run it once
+ * with the ring_delivery registry value set to 0 and once with it set to 1.
+ *
+ * Two sockets are opened, packets are sent from one to the address of the
+ * other and received, one at a time, for a range of payload sizes.
+ *
+ * Writes all results to stdout in a tab-seperated values format suitable for
+ * processing with gnuplot.
+ *
+ * The fields are:
+ *
+ *  1: payload size (bytes)
+ *  2: packets sent
+ *  3: packets received
+ *  4: mean time from sendto() until recv() returns (µs)
+ *  5: mean recv() call duration (µs)
+ *  6: throughput (bytes/sec)
+*/
+
+#include <winsock2.h>
+#include <windows.h>
+#include <wsipx.h>
+#include <wsnwlink.h>
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+static uint64_t PC_FREQUENCY;
+
+static uint64_t get_ticks_us(void)
+{
+	LARGE_INTEGER pc;
+	QueryPerformanceCounter(&pc);
+	
+	return pc.QuadPart / ((double)(PC_FREQUENCY) / 1000000);
+}
+
+static void run_test(int send_sock, int recv_sock, const struct sockaddr_ipx *recv_addr, unsigned int payload_size, unsigned int send_count)
+{
+	char *packet = calloc(payload_size, 1);
+	assert(packet != NULL);
+	
+	char *recv_buf = malloc(payload_size);
+	assert(recv_buf != NULL);
+	
+	unsigned int recv_packets = 0;
+	
+	uint64_t total_us = 0;
+	uint64_t recv_us  = 0;
+	
+	for(unsigned int n = 0; n < send_count; ++n)
+	{
+		memcpy(packet, &n, sizeof(n));
+		
+		uint64_t sent_at = get_ticks_us();
+		
+		int sr = sendto(send_sock, packet, payload_size, 0, (struct sockaddr*)(recv_addr), sizeof(*recv_addr));
+		if(sr != payload_size)
+		{
+			fprintf(stderr, "sendto = %d, WSAGetLastError = %d\n", sr, WSAGetLastError());
+			exit(1);
+		}
+		
+		fd_set read_fds;
+		FD_ZERO(&read_fds);
+		FD_SET(recv_sock, &read_fds);
+		
+		struct timeval tv = {
+			.tv_sec  = 1,
+			.tv_usec = 0,
+		};
+		
+		if(select(0, &read_fds, NULL, NULL, &tv) <= 0)
+		{
+			/* Lost. */
+			continue;
+		}
+		
+		uint64_t recv_start = get_ticks_us();
+		int rr = recv(recv_sock, recv_buf, payload_size, 0);
+		uint64_t recv_end = get_ticks_us();
+		
+		if(rr == payload_size && memcmp(recv_buf, &n, sizeof(n)) == 0)
+		{
+			++recv_packets;
+			
+			total_us += recv_end - sent_at;
+			recv_us  += recv_end - recv_start;
+		}
+	}
+	
+	printf("%u\t%u\t%u\t%f\t%f\t%f\n",
+		payload_size,
+		send_count,
+		recv_packets,
+		recv_packets ? (double)(total_us) / recv_packets : 0.0,
+		recv_packets ? (double)(recv_us) / recv_packets : 0.0,
+		total_us ? ((double)(recv_packets) * payload_size) / ((double)(total_us) / 1000000) : 0.0);
+	
+	free(recv_buf);
+	free(packet);
+}
+
+int main(int argc, char **argv)
+{
+	if(argc != 2)
+	{
+		fprintf(stderr, "Usage: %s <packet count>\n", argv[0]);
+		return 1;
+	}
+	
+	unsigned int send_count = strtoul(argv[1], NULL, 10);
+	
+	{
+		LARGE_INTEGER pc_freq;
+		QueryPerformanceFrequency(&pc_freq);
+		
+		PC_FREQUENCY = pc_freq.QuadPart;
+	}
+	
+	{
+		WSADATA wsaData;
+		assert(WSAStartup(MAKEWORD(1,1), &wsaData) == 0);
+	}
+	
+	struct sockaddr_ipx addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sa_family = AF_IPX;
+	
+	int send_sock = socket(AF_IPX, SOCK_DGRAM, NSPROTO_IPX);
+	assert(send_sock != -1);
+	assert(bind(send_sock, (struct sockaddr*)(&addr), sizeof(addr)) == 0);
+	
+	int recv_sock = socket(AF_IPX, SOCK_DGRAM, NSPROTO_IPX);
+	assert(recv_sock != -1);
+	assert(bind(recv_sock, (struct sockaddr*)(&addr), sizeof(addr)) == 0);
+	
+	struct sockaddr_ipx recv_addr;
+	int addrlen = sizeof(recv_addr);
+	
+	assert(getsockname(recv_sock, (struct sockaddr*)(&recv_addr), &addrlen) == 0);
+	
+	for(unsigned int size = 16; size <= 1024; size *= 2)
+	{
+		run_test(send_sock, recv_sock, &recv_addr, size, send_count);
+	}
+	
+	closesocket(recv_sock);
+	closesocket(send_sock);
+	
+	WSACleanup();
+	
+	return 0;
+}
@@ -0,0 +1,237 @@
+/* IPX(Wrapper) broadcast fan-out benchmarking tool
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* Measures how the cost of delivering a broadcast packet to local sockets
+ * scales with the number of sockets bound to the destination socket number.
+ *
+ * For each recipient count, that many sockets are bound to the same socket
+ * number with SO_REUSEADDR, then packets are broadcast to that socket number
+ * one at a time, waiting for every recipient to receive each one before the
+ * next is sent.
+ *
+ * Writes all results to stdout in a tab-seperated values format suitable for
+ * processing with gnuplot.
+ *
+ * The fields are:
+ *
+ *  1: recipient sockets
+ *  2: packets sent
+ *  3: packets received (total over all recipients)
+ *  4: packet loss (%)
+ *  5: mean time from sendto() until all recipients have the packet (µs)
+ *  6: mean cost per delivered packet (µs)
+*/
+
+#define FD_SETSIZE 512
+
+#include <winsock2.h>
+#include <windows.h>
+#include <wsipx.h>
+#include <wsnwlink.h>
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define MAX_RECIPIENTS 256
+#define BENCH_SOCKET   4321
+
+static uint64_t PC_FREQUENCY;
+
+static uint64_t get_ticks_us(void)
+{
+	LARGE_INTEGER pc;
+	QueryPerformanceCounter(&pc);
+	
+	return pc.QuadPart / ((double)(PC_FREQUENCY) / 1000000);
+}
+
+static int bound_socket(uint16_t socket_num)
+{
+	int sock = socket(AF_IPX, SOCK_DGRAM, NSPROTO_IPX);
+	assert(sock != -1);
+	
+	BOOL bcast = TRUE;
+	assert(setsockopt(sock, SOL_SOCKET, SO_BROADCAST, (void*)(&bcast), sizeof(bcast)) == 0);
+	
+	BOOL reuse = TRUE;
+	assert(setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (void*)(&reuse), sizeof(reuse)) == 0);
+	
+	struct sockaddr_ipx addr;
+	memset(&addr, 0, sizeof(addr));
+	
+	addr.sa_family = AF_IPX;
+	addr.sa_socket = htons(socket_num);
+	
+	assert(bind(sock, (struct sockaddr*)(&addr), sizeof(addr)) == 0);
+	
+	return sock;
+}
+
+static void run_test(int send_sock, const struct sockaddr_ipx *bcast_addr, unsigned int recipients, unsigned int send_count, unsigned int payload_size)
+{
+	assert(recipients <= MAX_RECIPIENTS);
+	
+	int recv_socks[MAX_RECIPIENTS];
+	
+	for(unsigned int i = 0; i < recipients; ++i)
+	{
+		recv_socks[i] = bound_socket(BENCH_SOCKET);
+	}
+	
+	char *packet = calloc(payload_size, 1);
+	assert(packet != NULL);
+	
+	char *recv_buf = malloc(payload_size);
+	assert(recv_buf != NULL);
+	
+	unsigned int recv_packets = 0;
+	uint64_t total_us = 0;
+	
+	for(unsigned int n = 0; n < send_count; ++n)
+	{
+		memcpy(packet, &n, sizeof(n));
+		
+		uint64_t sent_at = get_ticks_us();
+		
+		int sr = sendto(send_sock, packet, payload_size, 0, (struct sockaddr*)(bcast_addr), sizeof(*bcast_addr));
+		if(sr != payload_size)
+		{
+			fprintf(stderr, "sendto = %d, WSAGetLastError = %d\n", sr, WSAGetLastError());
+			exit(1);
+		}
+		
+		/* Wait until every recipient has received this packet, or
+		 * until no more arrive for a second.
+		*/
+		
+		unsigned int got = 0;
+		uint64_t done_at = sent_at;
+		
+		while(got < recipients)
+		{
+			fd_set read_fds;
+			FD_ZERO(&read_fds);
+			
+			for(unsigned int i = 0; i < recipients; ++i)
+			{
+				FD_SET(recv_socks[i], &read_fds);
+			}
+			
+			struct timeval tv = {
+				.tv_sec  = 1,
+				.tv_usec = 0,
+			};
+			
+			if(select(0, &read_fds, NULL, NULL, &tv) <= 0)
+			{
+				break;
+			}
+			
+			for(unsigned int i = 0; i < recipients; ++i)
+			{
+				if(!FD_ISSET(recv_socks[i], &read_fds))
+				{
+					continue;
+				}
+				
+				int rr = recv(recv_socks[i], recv_buf, payload_size, 0);
+				if(rr == payload_size && memcmp(recv_buf, &n, sizeof(n)) == 0)
+				{
+					done_at = get_ticks_us();
+					++got;
+				}
+			}
+		}
+		
+		recv_packets += got;
+		total_us     += done_at - sent_at;
+	}
+	
+	unsigned int expect_packets = send_count * recipients;
+	double loss_percent = ((double)(100) / expect_packets) * (expect_packets - recv_packets);
+	
+	printf("%u\t%u\t%u\t%f\t%f\t%f\n",
+		recipients,
+		send_count,
+		recv_packets,
+		loss_percent,
+		(double)(total_us) / send_count,
+		recv_packets ? (double)(total_us) / recv_packets : 0.0);
+	
+	free(recv_buf);
+	free(packet);
+	
+	for(unsigned int i = 0; i < recipients; ++i)
+	{
+		closesocket(recv_socks[i]);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if(argc != 3)
+	{
+		fprintf(stderr, "Usage: %s <packet count> <payload size>\n", argv[0]);
+		return 1;
+	}
+	
+	unsigned int send_count   = strtoul(argv[1], NULL, 10);
+	unsigned int payload_size = strtoul(argv[2], NULL, 10);
+	
+	if(send_count == 0 || payload_size < sizeof(unsigned int))
+	{
+		fprintf(stderr, "Invalid packet count or payload size\n");
+		return 1;
+	}
+	
+	{
+		LARGE_INTEGER pc_freq;
+		QueryPerformanceFrequency(&pc_freq);
+		
+		PC_FREQUENCY = pc_freq.QuadPart;
+	}
+	
+	{
+		WSADATA wsaData;
+		assert(WSAStartup(MAKEWORD(1,1), &wsaData) == 0);
+	}
+	
+	int send_sock = bound_socket(0);
+	
+	/* Broadcast on the network the sending socket was bound to. */
+	
+	struct sockaddr_ipx bcast_addr;
+	int addrlen = sizeof(bcast_addr);
+	
+	assert(getsockname(send_sock, (struct sockaddr*)(&bcast_addr), &addrlen) == 0);
+	
+	memset(bcast_addr.sa_nodenum, 0xFF, 6);
+	bcast_addr.sa_socket = htons(BENCH_SOCKET);
+	
+	for(unsigned int recipients = 1; recipients <= MAX_RECIPIENTS; recipients *= 2)
+	{
+		run_test(send_sock, &bcast_addr, recipients, send_count, payload_size);
+	}
+	
+	closesocket(send_sock);
+	
+	WSACleanup();
+	
+	return 0;
+}
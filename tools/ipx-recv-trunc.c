@@ -0,0 +1,157 @@
+/* IPXWrapper test tools
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* Sends packets to itself and reads them back into buffers which are too
+ * small, printing what each receive function returns:
+ *
+ *   fionread: <ioctlsocket(FIONREAD) size>
+ *   peek: <recvfrom(MSG_PEEK) return> <error> <data ok?>
+ *   recvfrom: <recvfrom() return> <error> <data ok?>
+ *   recvex: <WSARecvEx() return> <flags> <data ok?>
+ *   full: <recvfrom() return> <data ok?>
+*/
+
+#include <winsock2.h>
+#include <windows.h>
+#include <wsipx.h>
+#include <wsnwlink.h>
+#include <mswsock.h>
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SMALL_BUF_SIZE 10
+
+static int sock;
+static struct sockaddr_ipx self_addr;
+
+static char payload[256];
+
+static void send_self(int size)
+{
+	assert(sendto(sock, payload, size, 0, (struct sockaddr*)(&self_addr), sizeof(self_addr)) == size);
+	
+	fd_set read_fds;
+	FD_ZERO(&read_fds);
+	FD_SET(sock, &read_fds);
+	
+	struct timeval tv = {
+		.tv_sec  = 5,
+		.tv_usec = 0,
+	};
+	
+	assert(select(sock + 1, &read_fds, NULL, NULL, &tv) == 1);
+}
+
+static const char *data_ok(const char *buf, int size)
+{
+	return memcmp(buf, payload, size) == 0 ? "ok" : "bad";
+}
+
+int main(int argc, char **argv)
+{
+	if(argc != 2)
+	{
+		fprintf(stderr, "Usage: %s <payload size>\n", argv[0]);
+		return 1;
+	}
+	
+	int size = atoi(argv[1]);
+	assert(size > SMALL_BUF_SIZE && size <= (int)(sizeof(payload)));
+	
+	for(size_t i = 0; i < sizeof(payload); ++i)
+	{
+		payload[i] = 'A' + (i % 26);
+	}
+	
+	{
+		WSADATA wsaData;
+		assert(WSAStartup(MAKEWORD(1,1), &wsaData) == 0);
+	}
+	
+	sock = socket(AF_IPX, SOCK_DGRAM, NSPROTO_IPX);
+	assert(sock != -1);
+	
+	struct sockaddr_ipx addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sa_family = AF_IPX;
+	
+	assert(bind(sock, (struct sockaddr*)(&addr), sizeof(addr)) == 0);
+	
+	int addrlen = sizeof(self_addr);
+	assert(getsockname(sock, (struct sockaddr*)(&self_addr), &addrlen) == 0);
+	
+	char buf[sizeof(payload)];
+	
+	/* One packet, sized by FIONREAD, peeked at and then read into a short
+	 * buffer by recvfrom().
+	*/
+	
+	send_self(size);
+	
+	{
+		u_long avail;
+		assert(ioctlsocket(sock, FIONREAD, &avail) == 0);
+		
+		printf("fionread: %lu\n", avail);
+	}
+	
+	{
+		memset(buf, 0, sizeof(buf));
+		
+		int r = recvfrom(sock, buf, SMALL_BUF_SIZE, MSG_PEEK, NULL, NULL);
+		printf("peek: %d %d %s\n", r, WSAGetLastError(), data_ok(buf, SMALL_BUF_SIZE));
+	}
+	
+	{
+		memset(buf, 0, sizeof(buf));
+		
+		int r = recvfrom(sock, buf, SMALL_BUF_SIZE, 0, NULL, NULL);
+		printf("recvfrom: %d %d %s\n", r, WSAGetLastError(), data_ok(buf, SMALL_BUF_SIZE));
+	}
+	
+	/* Another read into a short buffer by WSARecvEx(). */
+	
+	send_self(size);
+	
+	{
+		memset(buf, 0, sizeof(buf));
+		
+		int flags = 0;
+		int r = WSARecvEx(sock, buf, SMALL_BUF_SIZE, &flags);
+		
+		printf("recvex: %d %s %s\n", r, (flags & MSG_PARTIAL ? "MSG_PARTIAL" : "0"), data_ok(buf, SMALL_BUF_SIZE));
+	}
+	
+	/* And one which fits. */
+	
+	send_self(size);
+	
+	{
+		memset(buf, 0, sizeof(buf));
+		
+		int r = recvfrom(sock, buf, sizeof(buf), 0, NULL, NULL);
+		printf("full: %d %s\n", r, data_ok(buf, size));
+	}
+	
+	closesocket(sock);
+	
+	WSACleanup();
+	
+	return 0;
+}
@@ -0,0 +1,224 @@
+/* IPXWrapper test tools
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* Sends packets from several threads at once, each with its own socket, for
+ * checking that sendto() calls on different sockets don't get in each other's
+ * way.
+ *
+ * Each thread broadcasts the given number of packets to its own socket number
+ * as fast as it can, so every packet is delivered to the sending socket and
+ * also comes back from the network to the router thread. sendto() failing with
+ * WSAENOBUFS just means the threads are outrunning the network, so the send is
+ * retried and counted separately.
+ *
+ * Prints the number of packets sent, sendto() failures and retries, the number
+ * of packets the router received meanwhile and the number of sockets which got
+ * their own packets back.
+*/
+
+#include <winsock2.h>
+#include <windows.h>
+#include <wsipx.h>
+#include <wsnwlink.h>
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "router.h"
+
+#define MAX_THREADS 64
+
+struct sender {
+	int sock;
+	struct sockaddr_ipx dest;
+	
+	HANDLE thread;
+	
+	uint64_t sent;
+	uint64_t errors;
+	uint64_t retries;
+};
+
+static unsigned int n_packets;
+static unsigned int payload_size;
+
+static HANDLE start_event;
+
+static DWORD WINAPI sender_main(LPVOID arg)
+{
+	struct sender *sender = arg;
+	
+	char *payload = calloc(payload_size, 1);
+	assert(payload != NULL);
+	
+	WaitForSingleObject(start_event, INFINITE);
+	
+	for(unsigned int i = 0; i < n_packets;)
+	{
+		if(sendto(sender->sock, payload, payload_size, 0, (struct sockaddr*)(&(sender->dest)), sizeof(sender->dest)) == payload_size)
+		{
+			++(sender->sent);
+			++i;
+		}
+		else if(WSAGetLastError() == WSAENOBUFS)
+		{
+			++(sender->retries);
+			Sleep(1);
+		}
+		else{
+			++(sender->errors);
+			++i;
+		}
+	}
+	
+	free(payload);
+	
+	return 0;
+}
+
+static uint64_t router_rx_packets(int sock)
+{
+	struct router_stats stats;
+	int len = sizeof(stats);
+	
+	assert(getsockopt(sock, NSPROTO_IPX, IPXWRAPPER_ROUTER_STATS, (char*)(&stats), &len) == 0);
+	
+	return stats.rx_packets;
+}
+
+/* Read everything waiting on a socket without blocking, returns the number of
+ * packets read.
+*/
+static unsigned int drain_socket(int sock)
+{
+	u_long nonblock = 1;
+	assert(ioctlsocket(sock, FIONBIO, &nonblock) == 0);
+	
+	char *buf = malloc(payload_size);
+	assert(buf != NULL);
+	
+	unsigned int n = 0;
+	
+	while(recv(sock, buf, payload_size, 0) == payload_size)
+	{
+		++n;
+	}
+	
+	free(buf);
+	
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	if(argc != 4)
+	{
+		fprintf(stderr, "Usage: %s <thread count> <packets per thread> <payload size>\n", argv[0]);
+		return 1;
+	}
+	
+	unsigned int n_threads = strtoul(argv[1], NULL, 10);
+	n_packets              = strtoul(argv[2], NULL, 10);
+	payload_size           = strtoul(argv[3], NULL, 10);
+	
+	assert(n_threads > 0 && n_threads <= MAX_THREADS);
+	
+	{
+		WSADATA wsaData;
+		assert(WSAStartup(MAKEWORD(1,1), &wsaData) == 0);
+	}
+	
+	assert((start_event = CreateEvent(NULL, TRUE, FALSE, NULL)) != NULL);
+	
+	static struct sender senders[MAX_THREADS];
+	
+	for(unsigned int i = 0; i < n_threads; ++i)
+	{
+		struct sender *sender = &(senders[i]);
+		
+		sender->sock = socket(AF_IPX, SOCK_DGRAM, NSPROTO_IPX);
+		assert(sender->sock != -1);
+		
+		BOOL bcast = TRUE;
+		assert(setsockopt(sender->sock, SOL_SOCKET, SO_BROADCAST, (char*)(&bcast), sizeof(bcast)) == 0);
+		
+		struct sockaddr_ipx addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sa_family = AF_IPX;
+		
+		assert(bind(sender->sock, (struct sockaddr*)(&addr), sizeof(addr)) == 0);
+		
+		int addrlen = sizeof(sender->dest);
+		assert(getsockname(sender->sock, (struct sockaddr*)(&(sender->dest)), &addrlen) == 0);
+		
+		memset(sender->dest.sa_nodenum, 0xFF, sizeof(sender->dest.sa_nodenum));
+		
+		assert((sender->thread = CreateThread(NULL, 0, &sender_main, sender, 0, NULL)) != NULL);
+	}
+	
+	uint64_t rx_before = router_rx_packets(senders[0].sock);
+	
+	SetEvent(start_event);
+	
+	uint64_t sent = 0, errors = 0, retries = 0;
+	
+	for(unsigned int i = 0; i < n_threads; ++i)
+	{
+		WaitForSingleObject(senders[i].thread, INFINITE);
+		CloseHandle(senders[i].thread);
+		
+		sent    += senders[i].sent;
+		errors  += senders[i].errors;
+		retries += senders[i].retries;
+	}
+	
+	/* Give the router a moment to deliver the last packets. */
+	
+	Sleep(500);
+	
+	uint64_t rx_after = router_rx_packets(senders[0].sock);
+	
+	unsigned int echoed = 0;
+	
+	for(unsigned int i = 0; i < n_threads; ++i)
+	{
+		if(drain_socket(senders[i].sock) > 0)
+		{
+			++echoed;
+		}
+	}
+	
+	printf("threads: %u\n", n_threads);
+	printf("sent: %" PRIu64 "\n", sent);
+	printf("errors: %" PRIu64 "\n", errors);
+	printf("retries: %" PRIu64 "\n", retries);
+	printf("router_rx: %" PRIu64 "\n", rx_after - rx_before);
+	printf("echoed: %u\n", echoed);
+	
+	for(unsigned int i = 0; i < n_threads; ++i)
+	{
+		closesocket(senders[i].sock);
+	}
+	
+	CloseHandle(start_event);
+	
+	WSACleanup();
+	
+	return 0;
+}